@@ -0,0 +1,111 @@
+# Helpers shared by the benchmark scripts: a host Xvfb, nested servers
+# running the driver from the build tree, and their statistics pages.
+#
+# Set before sourcing:
+#   builddir   top of the build tree
+#   workdir    scratch directory, removed by bench_cleanup
+
+BENCH_BACKEND=${BENCH_BACKEND:-xcb}
+BENCH_HOST_SIZE=${BENCH_HOST_SIZE:-1920x1080x24}
+BENCH_SIZE=${BENCH_SIZE:-1280x720}
+
+bench_pids=
+
+# bench_require command...: exits with 77 (skipped) if one is missing
+bench_require() {
+    for cmd in "$@"; do
+        if ! command -v "$cmd" > /dev/null 2>&1; then
+            echo "$cmd not found, skipping" >&2
+            exit 77
+        fi
+    done
+}
+
+bench_cleanup() {
+    for pid in $bench_pids; do
+        kill "$pid" 2> /dev/null
+    done
+    wait 2> /dev/null
+    rm -rf "$workdir"
+}
+
+# bench_wait_display display: waits for a server to accept clients
+bench_wait_display() {
+    for i in $(seq 100); do
+        xdpyinfo -display "$1" > /dev/null 2>&1 && return 0
+        sleep 0.1
+    done
+    echo "$1 did not come up" >&2
+    return 1
+}
+
+# bench_start_host display: starts Xvfb, sets host_pid
+bench_start_host() {
+    Xvfb "$1" -screen 0 "$BENCH_HOST_SIZE" -nolisten tcp \
+        > "$workdir/Xvfb$1.log" 2>&1 &
+    host_pid=$!
+    bench_pids="$bench_pids $host_pid"
+    bench_wait_display "$1"
+}
+
+# bench_start_nested display host [origin]: starts Xorg with the driver
+# built in builddir shown on host, sets nested_pid and nested_stats
+bench_start_nested() {
+    conf="$workdir/xorg$1.conf"
+
+    cat > "$conf" <<CONF
+Section "ServerFlags"
+    Option "AutoEnableDevices" "false"
+    Option "AutoAddDevices" "false"
+    Option "AllowEmptyInput" "true"
+EndSection
+
+Section "Files"
+    ModulePath "$builddir/src/.libs"
+    ModulePath "${BENCH_MODULE_PATH:-/usr/lib/xorg/modules}"
+EndSection
+
+Section "Device"
+    Identifier "device"
+    Driver "nested"
+    Option "Display" "$2"
+    Option "Backend" "$BENCH_BACKEND"
+    Option "Stats" "true"
+    Option "Origin" "${3:-0 0}"
+EndSection
+
+Section "Screen"
+    Identifier "screen"
+    Device "device"
+    DefaultDepth 24
+    SubSection "Display"
+        Depth 24
+        Modes "$BENCH_SIZE"
+    EndSubSection
+EndSection
+
+Section "ServerLayout"
+    Identifier "layout"
+    Screen "screen"
+EndSection
+CONF
+
+    # Many of them may run at once: none of them may take over a VT
+    Xorg "$1" -config "$conf" -logfile "$workdir/Xorg$1.log" -noreset \
+        -nolisten tcp -sharevts -novtswitch > /dev/null 2>&1 &
+    nested_pid=$!
+    bench_pids="$bench_pids $nested_pid"
+    bench_wait_display "$1" || return 1
+    nested_stats=/dev/shm/nested-stats.$nested_pid.0
+}
+
+# bench_cpu_ticks pid: user + system clock ticks used so far
+bench_cpu_ticks() {
+    # The command name may have spaces: count fields from the last ')'
+    sed 's/.*) //' "/proc/$1/stat" | awk '{ print $12 + $13 }'
+}
+
+# bench_rss_kb pid: resident memory
+bench_rss_kb() {
+    awk '/^VmRSS:/ { print $2 }' "/proc/$1/status"
+}
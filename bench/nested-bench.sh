@@ -0,0 +1,95 @@
+#! /bin/sh
+#
+# End-to-end benchmark of the update path: runs Xorg with the driver from
+# the build tree on an Xvfb host, moves the host pointer over it through
+# XTest and runs each workload inside it for BENCH_SECONDS. Reports per
+# workload:
+#   fps           shadow updates per second
+#   bytes/frame   uploaded to the host
+#   cpu-ms/frame  of the nested server
+#   lat-p50/p99   from the host pointer event to the upload it caused, us
+#
+# Usage: nested-bench.sh builddir
+# Also reads BENCH_SECONDS, BENCH_HOST_DISPLAY, BENCH_DISPLAY and the
+# variables of bench-lib.sh.
+
+srcdir=$(dirname $0)
+builddir=${1:-.}
+workdir=$(mktemp -d)
+
+. "$srcdir/bench-lib.sh"
+
+seconds=${BENCH_SECONDS:-10}
+host=${BENCH_HOST_DISPLAY:-:91}
+nested=${BENCH_DISPLAY:-:92}
+stat="$builddir/tools/nested-stat"
+
+bench_require Xvfb Xorg xdpyinfo xdotool x11perf xsetroot
+
+trap bench_cleanup EXIT INT TERM
+
+bench_start_host "$host" || exit 1
+bench_start_nested "$nested" "$host" || {
+    cat "$workdir/Xorg$nested.log" >&2
+    exit 1
+}
+
+# Circles the host pointer over the nested window; the software cursor
+# moving is damage, so each event is followed to its upload.
+move_pointer() {
+    while :; do
+        DISPLAY=$host xdotool mousemove 200 200 sleep 0.01 \
+                              mousemove 400 200 sleep 0.01 \
+                              mousemove 400 400 sleep 0.01 \
+                              mousemove 200 400 sleep 0.01
+    done
+}
+
+workload_scroll() {
+    DISPLAY=$nested timeout "$seconds" x11perf -scroll500 -repeat 1000
+}
+
+workload_fill() {
+    DISPLAY=$nested timeout "$seconds" sh -c \
+        'while :; do xsetroot -solid red; xsetroot -solid blue; done'
+}
+
+workload_spam() {
+    DISPLAY=$nested timeout "$seconds" x11perf -rect1 -repeat 1000
+}
+
+printf "%-8s %8s %12s %13s %12s %12s\n" \
+       workload fps bytes/frame cpu-ms/frame lat-p50-us lat-p99-us
+
+hz=$(getconf CLK_TCK)
+
+for workload in scroll fill spam; do
+    move_pointer > /dev/null 2>&1 &
+    mover=$!
+
+    "$stat" -i "$seconds" -n 1 "$nested_stats" > "$workdir/rates" &
+    rates=$!
+    "$stat" -l -i "$seconds" -n 1 "$nested_stats" > "$workdir/latency" &
+    latency=$!
+    ticks=$(bench_cpu_ticks $nested_pid)
+
+    workload_$workload > /dev/null 2>&1
+    wait $rates $latency
+
+    ticks=$(($(bench_cpu_ticks $nested_pid) - ticks))
+    kill $mover 2> /dev/null
+    wait $mover 2> /dev/null
+
+    # Second lines: upd/s and KB/s; p50 and p99 of event to upload
+    fps=$(awk 'NR == 2 { print $3 }' "$workdir/rates")
+    kbs=$(awk 'NR == 2 { print $5 }' "$workdir/rates")
+    lat=$(awk 'NR == 2 { print $9, $10 }' "$workdir/latency")
+
+    echo "$workload $fps $kbs $ticks $hz $seconds $lat" | awk '{
+        frames = $2 * $6
+        bytes = $2 > 0 ? $3 * 1024 / $2 : 0
+        cpu = frames > 0 ? $4 * 1000 / $5 / frames : 0
+        printf "%-8s %8.1f %12.0f %13.2f %12s %12s\n", $1, $2, bytes, cpu,
+               $7, $8
+    }'
+done
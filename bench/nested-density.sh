@@ -0,0 +1,112 @@
+#! /bin/sh
+#
+# Density benchmark: runs N nested servers (N from BENCH_COUNTS, 1 to 64 by
+# default) on one Xvfb host, each with the same light workload, and
+# reports per instance after BENCH_SECONDS:
+#   host-cpu%    of the Xvfb host, divided by N
+#   nested-cpu%  mean over the nested servers
+#   rss-kb       mean resident memory of the nested servers
+#   shm-kb       System V shared memory attached by them, per instance
+#
+# Usage: nested-density.sh builddir
+# Also reads the variables of bench-lib.sh; BENCH_SIZE defaults to a
+# small window here so 64 of them fit side by side on the host.
+
+srcdir=$(dirname $0)
+builddir=${1:-.}
+workdir=$(mktemp -d)
+
+BENCH_SIZE=${BENCH_SIZE:-240x135}
+. "$srcdir/bench-lib.sh"
+
+seconds=${BENCH_SECONDS:-10}
+counts=${BENCH_COUNTS:-"1 2 4 8 16 32 64"}
+host=${BENCH_HOST_DISPLAY:-:91}
+first=${BENCH_DISPLAY_BASE:-100}
+hz=$(getconf CLK_TCK)
+
+# The windows must not overlap, or they'd show different amounts of
+# their screens and do different work
+width=${BENCH_SIZE%%x*}
+height=${BENCH_SIZE#*x}
+host_width=${BENCH_HOST_SIZE%%x*}
+host_height=${BENCH_HOST_SIZE#*x}
+host_height=${host_height%%x*}
+columns=$((host_width / width))
+[ $columns -gt 0 ] || columns=1
+fit=$((columns * (host_height / height)))
+
+bench_require Xvfb Xorg xdpyinfo x11perf
+
+trap bench_cleanup EXIT INT TERM
+
+bench_start_host "$host" || exit 1
+
+# SHM of the segments a process has attached: /proc/sysvipc/shm lists
+# size (field 4), creator (field 5) and last attacher (field 6)
+shm_kb() {
+    awk -v pids=" $* " '
+        NR > 1 && (index(pids, " " $5 " ") || index(pids, " " $6 " ")) {
+            sum += $4
+        }
+        END { print int(sum / 1024) }' /proc/sysvipc/shm
+}
+
+printf "%9s %10s %12s %10s %10s\n" \
+       instances host-cpu% nested-cpu% rss-kb shm-kb
+
+for n in $counts; do
+    if [ $n -gt $fit ]; then
+        echo "nested-density: only $fit windows of $BENCH_SIZE fit on" \
+             "$BENCH_HOST_SIZE, skipping $n" >&2
+        continue
+    fi
+
+    pids=
+    i=0
+    while [ $i -lt $n ]; do
+        # Laid out on the host in rows, like a wall of kiosks
+        bench_start_nested ":$((first + i))" "$host" \
+            "$((i % columns * width)) $((i / columns * height))" || exit 1
+        pids="$pids $nested_pid"
+        i=$((i + 1))
+    done
+
+    # A light, identical workload: one small animation per server
+    workers=
+    i=0
+    while [ $i -lt $n ]; do
+        DISPLAY=":$((first + i))" timeout "$seconds" \
+            x11perf -rect10 -repeat 1000 > /dev/null 2>&1 &
+        workers="$workers $!"
+        i=$((i + 1))
+    done
+
+    host_ticks=$(bench_cpu_ticks $host_pid)
+    nested_ticks=0
+    for pid in $pids; do
+        nested_ticks=$((nested_ticks - $(bench_cpu_ticks $pid)))
+    done
+
+    wait $workers
+
+    host_ticks=$(($(bench_cpu_ticks $host_pid) - host_ticks))
+    rss=0
+    for pid in $pids; do
+        nested_ticks=$((nested_ticks + $(bench_cpu_ticks $pid)))
+        rss=$((rss + $(bench_rss_kb $pid)))
+    done
+    shm=$(shm_kb $pids)
+
+    echo "$n $host_ticks $nested_ticks $rss $shm $hz $seconds" | awk '{
+        cpu = $6 * $7 / 100
+        printf "%9d %10.2f %12.2f %10d %10d\n", $1, $2 / cpu / $1,
+               $3 / cpu / $1, $4 / $1, $5 / $1
+    }'
+
+    for pid in $pids; do
+        kill $pid
+        wait $pid 2> /dev/null
+    done
+    bench_pids=$host_pid
+done
@@ -0,0 +1,291 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Dispatches the NestedClient* calls to the backend each screen was
+ * created with. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <string.h>
+
+#include <X11/Xlib.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "client.h"
+#include "probes.h"
+
+/* The first one is the default */
+static NestedClientBackendPtr nestedBackends[] = {
+    &nestedXcbBackend,
+    &nestedXlibBackend,
+    &nestedExportBackend,
+    &nestedNullBackend,
+    NULL
+};
+
+static pthread_once_t nestedXlibOnce = PTHREAD_ONCE_INIT;
+
+static void
+NestedClientInitXlib(void) {
+    XInitThreads();
+}
+
+/* Every backend is looked up through one of the two functions below before
+ * it is used, so Xlib is made thread safe ahead of any XOpenDisplay, be it
+ * a probe's or a bring-up thread's. */
+NestedClientBackendPtr
+NestedClientFindBackend(const char *name) {
+    int i;
+
+    pthread_once(&nestedXlibOnce, NestedClientInitXlib);
+
+    if (!name)
+        return nestedBackends[0];
+
+    for (i = 0; nestedBackends[i]; i++)
+        if (!strcasecmp(nestedBackends[i]->name, name))
+            return nestedBackends[i];
+
+    return NULL;
+}
+
+NestedClientBackendPtr
+NestedClientProbeBackend(int scrnIndex, char *displayName, int depth) {
+    static const char *transports[] = { "none", "copies", "shared memory" };
+    NestedClientBackendPtr best = NULL;
+    int i, transport, bestTransport = NESTED_TRANSPORT_NONE;
+
+    pthread_once(&nestedXlibOnce, NestedClientInitXlib);
+
+    for (i = 0; nestedBackends[i]; i++) {
+        if (!nestedBackends[i]->validDepth(depth)) {
+            xf86DrvMsg(scrnIndex, X_PROBED, "Backend %s: no depth %d\n",
+                       nestedBackends[i]->name, depth);
+            continue;
+        }
+
+        transport = nestedBackends[i]->probe(displayName);
+        xf86DrvMsg(scrnIndex, X_PROBED, "Backend %s: %s\n",
+                   nestedBackends[i]->name, transports[transport]);
+
+        if (transport > bestTransport) {
+            best = nestedBackends[i];
+            bestTransport = transport;
+        }
+    }
+
+    return best;
+}
+
+Bool
+NestedClientCheckDisplay(NestedClientBackendPtr backend, char *displayName) {
+    return backend->checkDisplay(displayName);
+}
+
+Bool
+NestedClientValidDepth(NestedClientBackendPtr backend, int depth) {
+    return backend->validDepth(depth);
+}
+
+NestedClientPrivatePtr
+NestedClientCreateScreen(NestedClientBackendPtr backend,
+                         int scrnIndex,
+                         char *displayName,
+                         int width,
+                         int height,
+                         int windowWidth,
+                         int windowHeight,
+                         int originX,
+                         int originY,
+                         int depth,
+                         int bitsPerPixel,
+                         int transportDepth,
+                         unsigned int fbFlags,
+                         uint32_t *retRedMask,
+                         uint32_t *retGreenMask,
+                         uint32_t *retBlueMask) {
+    return backend->createScreen(scrnIndex, displayName, width, height,
+                                 windowWidth, windowHeight, originX, originY,
+                                 depth, bitsPerPixel, transportDepth, fbFlags,
+                                 retRedMask, retGreenMask, retBlueMask);
+}
+
+NestedClientPendingPtr
+NestedClientStartScreen(NestedClientBackendPtr backend,
+                        int scrnIndex,
+                        char *displayName,
+                        int width,
+                        int height,
+                        int windowWidth,
+                        int windowHeight,
+                        int originX,
+                        int originY,
+                        int depth,
+                        int bitsPerPixel,
+                        int transportDepth,
+                        unsigned int fbFlags) {
+    return backend->startScreen(scrnIndex, displayName, width, height,
+                                windowWidth, windowHeight, originX, originY,
+                                depth, bitsPerPixel, transportDepth, fbFlags);
+}
+
+NestedClientPrivatePtr
+NestedClientFinishScreen(NestedClientPendingPtr pending,
+                         uint32_t *retRedMask,
+                         uint32_t *retGreenMask,
+                         uint32_t *retBlueMask) {
+    return NESTED_CLIENT_BACKEND(pending)->finishScreen(pending, retRedMask,
+                                                        retGreenMask,
+                                                        retBlueMask);
+}
+
+NestedClientPrivatePtr
+NestedClientCreateTile(NestedClientBackendPtr backend,
+                       int scrnIndex,
+                       char *displayName,
+                       char *fb,
+                       int fbStride,
+                       int x,
+                       int y,
+                       int width,
+                       int height,
+                       int originX,
+                       int originY,
+                       int depth,
+                       int bitsPerPixel,
+                       int transportDepth,
+                       NestedClientPrivatePtr inputOwner) {
+    return backend->createTile(scrnIndex, displayName, fb, fbStride, x, y,
+                               width, height, originX, originY, depth,
+                               bitsPerPixel, transportDepth, inputOwner);
+}
+
+char *
+NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv) {
+    return NESTED_CLIENT_BACKEND(pPriv)->getFrameBuffer(pPriv);
+}
+
+Bool
+NestedClientSetAsync(NestedClientPrivatePtr pPriv) {
+    return NESTED_CLIENT_BACKEND(pPriv)->setAsync(pPriv);
+}
+
+void
+NestedClientUpdateScreen(NestedClientPrivatePtr pPriv, int x1, int y1,
+                         int x2, int y2) {
+    NESTED_PROBE5(upload_start, pPriv, x1, y1, x2, y2);
+    NESTED_CLIENT_BACKEND(pPriv)->updateScreen(pPriv, x1, y1, x2, y2);
+    NESTED_PROBE1(upload_end, pPriv);
+}
+
+void
+NestedClientSetColor(NestedClientPrivatePtr pPriv, int index,
+                     uint16_t red, uint16_t green, uint16_t blue) {
+    NESTED_CLIENT_BACKEND(pPriv)->setColor(pPriv, index, red, green, blue);
+}
+
+void
+NestedClientUpdatePalette(NestedClientPrivatePtr pPriv) {
+    NESTED_CLIENT_BACKEND(pPriv)->updatePalette(pPriv);
+}
+
+void
+NestedClientSetWorkers(NestedClientPrivatePtr pPriv,
+                       NestedWorkersPtr workers) {
+    NESTED_CLIENT_BACKEND(pPriv)->setWorkers(pPriv, workers);
+}
+
+void
+NestedClientSetStats(NestedClientPrivatePtr pPriv, NestedStatsPtr stats) {
+    NESTED_CLIENT_BACKEND(pPriv)->setStats(pPriv, stats);
+}
+
+void
+NestedClientReleaseFrameBuffer(NestedClientPrivatePtr pPriv, int height) {
+    NESTED_CLIENT_BACKEND(pPriv)->releaseFrameBuffer(pPriv, height);
+}
+
+void
+NestedClientSetViewport(NestedClientPrivatePtr pPriv, int x, int y) {
+    NESTED_CLIENT_BACKEND(pPriv)->setViewport(pPriv, x, y);
+}
+
+void
+NestedClientResizeWindow(NestedClientPrivatePtr pPriv, int width,
+                         int height) {
+    NESTED_CLIENT_BACKEND(pPriv)->resizeWindow(pPriv, width, height);
+}
+
+void
+NestedClientSetResizeHandler(NestedClientPrivatePtr pPriv,
+                             NestedClientResizeProc proc, void *data) {
+    NESTED_CLIENT_BACKEND(pPriv)->setResizeHandler(pPriv, proc, data);
+}
+
+void
+NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
+    NESTED_CLIENT_BACKEND(pPriv)->hideCursor(pPriv);
+}
+
+void
+NestedClientSetParked(NestedClientPrivatePtr pPriv, Bool parked) {
+    NESTED_CLIENT_BACKEND(pPriv)->setParked(pPriv, parked);
+}
+
+void
+NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
+    NESTED_PROBE1(events_start, pPriv);
+    NESTED_CLIENT_BACKEND(pPriv)->checkEvents(pPriv);
+    NESTED_PROBE1(events_end, pPriv);
+}
+
+void
+NestedClientProcessDeferred(NestedClientPrivatePtr pPriv) {
+    NESTED_CLIENT_BACKEND(pPriv)->processDeferred(pPriv);
+}
+
+void
+NestedClientCloseScreen(NestedClientPrivatePtr pPriv) {
+    NESTED_CLIENT_BACKEND(pPriv)->closeScreen(pPriv);
+}
+
+void
+NestedClientSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev) {
+    NESTED_CLIENT_BACKEND(pPriv)->setDevicePtr(pPriv, dev);
+}
+
+int
+NestedClientGetFileDescriptor(NestedClientPrivatePtr pPriv) {
+    return NESTED_CLIENT_BACKEND(pPriv)->getFileDescriptor(pPriv);
+}
+
+Bool
+NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv,
+                                KeySymsPtr keySyms, CARD8 *modmap,
+                                XkbControlsPtr ctrls) {
+    return NESTED_CLIENT_BACKEND(pPriv)->getKeyboardMappings(pPriv, keySyms,
+                                                             modmap, ctrls);
+}
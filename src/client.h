@@ -35,37 +35,214 @@
 
 #include <X11/extensions/XKBstr.h>
 
+#include "stats.h"
+#include "workers.h"
+
 struct NestedClientPrivate;
 typedef struct NestedClientPrivate *NestedClientPrivatePtr;
 
-Bool NestedClientCheckDisplay(char *displayName);
+struct NestedClientPendingScreen;
+typedef struct NestedClientPendingScreen *NestedClientPendingPtr;
+
+/* Called when the host window is resized by the user */
+typedef void (*NestedClientResizeProc)(void *data, int width, int height);
+
+/* How a backend would get images to the host, best last */
+#define NESTED_TRANSPORT_NONE 0 /* it can't show anything there */
+#define NESTED_TRANSPORT_COPY 1 /* images are sent over the connection */
+#define NESTED_TRANSPORT_SHM  2 /* the host reads them from shared memory */
+
+/* A client backend: the calls below dispatch to the backend a screen was
+ * created with. Each backend's struct NestedClientPrivate and struct
+ * NestedClientPendingScreen start with a pointer to its ops. */
+typedef struct NestedClientBackend {
+    const char *name;
+    Bool (*checkDisplay)(char *displayName);
+    Bool (*validDepth)(int depth);
+    int (*probe)(char *displayName); /* a NESTED_TRANSPORT_* */
+    NestedClientPrivatePtr (*createScreen)(int scrnIndex, char *displayName,
+                                           int width, int height,
+                                           int windowWidth, int windowHeight,
+                                           int originX, int originY,
+                                           int depth, int bitsPerPixel,
+                                           int transportDepth,
+                                           unsigned int fbFlags,
+                                           uint32_t *retRedMask,
+                                           uint32_t *retGreenMask,
+                                           uint32_t *retBlueMask);
+    NestedClientPendingPtr (*startScreen)(int scrnIndex, char *displayName,
+                                          int width, int height,
+                                          int windowWidth, int windowHeight,
+                                          int originX, int originY,
+                                          int depth, int bitsPerPixel,
+                                          int transportDepth,
+                                          unsigned int fbFlags);
+    NestedClientPrivatePtr (*finishScreen)(NestedClientPendingPtr pending,
+                                           uint32_t *retRedMask,
+                                           uint32_t *retGreenMask,
+                                           uint32_t *retBlueMask);
+    NestedClientPrivatePtr (*createTile)(int scrnIndex, char *displayName,
+                                         char *fb, int fbStride, int x, int y,
+                                         int width, int height,
+                                         int originX, int originY,
+                                         int depth, int bitsPerPixel,
+                                         int transportDepth,
+                                         NestedClientPrivatePtr inputOwner);
+    char *(*getFrameBuffer)(NestedClientPrivatePtr pPriv);
+    Bool (*setAsync)(NestedClientPrivatePtr pPriv);
+    void (*updateScreen)(NestedClientPrivatePtr pPriv,
+                         int x1, int y1, int x2, int y2);
+    void (*setColor)(NestedClientPrivatePtr pPriv, int index,
+                     uint16_t red, uint16_t green, uint16_t blue);
+    void (*updatePalette)(NestedClientPrivatePtr pPriv);
+    void (*setWorkers)(NestedClientPrivatePtr pPriv,
+                       NestedWorkersPtr workers);
+    void (*setStats)(NestedClientPrivatePtr pPriv, NestedStatsPtr stats);
+    void (*releaseFrameBuffer)(NestedClientPrivatePtr pPriv, int height);
+    void (*setViewport)(NestedClientPrivatePtr pPriv, int x, int y);
+    void (*resizeWindow)(NestedClientPrivatePtr pPriv, int width,
+                         int height);
+    void (*setResizeHandler)(NestedClientPrivatePtr pPriv,
+                             NestedClientResizeProc proc, void *data);
+    void (*hideCursor)(NestedClientPrivatePtr pPriv);
+    void (*setParked)(NestedClientPrivatePtr pPriv, Bool parked);
+    void (*checkEvents)(NestedClientPrivatePtr pPriv);
+    void (*processDeferred)(NestedClientPrivatePtr pPriv);
+    void (*closeScreen)(NestedClientPrivatePtr pPriv);
+    void (*setDevicePtr)(NestedClientPrivatePtr pPriv, DeviceIntPtr dev);
+    int (*getFileDescriptor)(NestedClientPrivatePtr pPriv);
+    Bool (*getKeyboardMappings)(NestedClientPrivatePtr pPriv,
+                                KeySymsPtr keySyms, CARD8 *modmap,
+                                XkbControlsPtr ctrls);
+} NestedClientBackendRec;
+
+typedef const NestedClientBackendRec *NestedClientBackendPtr;
+
+#define NESTED_CLIENT_BACKEND(p) (*(NestedClientBackendPtr *)(p))
+
+extern const NestedClientBackendRec nestedXcbBackend;
+extern const NestedClientBackendRec nestedXlibBackend;
+extern const NestedClientBackendRec nestedExportBackend; /* to local consumers */
+extern const NestedClientBackendRec nestedNullBackend; /* no host at all */
 
-Bool NestedClientValidDepth(int depth);
+/* Returns the backend with the given name, the default one for NULL */
+NestedClientBackendPtr NestedClientFindBackend(const char *name);
 
-NestedClientPrivatePtr NestedClientCreateScreen(int    scrnIndex,
+/* Returns the backend with the best transport to the display, the first
+ * registered on ties; NULL if none can use it at the given depth */
+NestedClientBackendPtr NestedClientProbeBackend(int scrnIndex,
+                                                char *displayName,
+                                                int depth);
+
+Bool NestedClientCheckDisplay(NestedClientBackendPtr backend,
+                              char *displayName);
+
+Bool NestedClientValidDepth(NestedClientBackendPtr backend, int depth);
+
+NestedClientPrivatePtr NestedClientCreateScreen(NestedClientBackendPtr backend,
+                                                int    scrnIndex,
                                                 char  *displayName,
                                                 int    width,
                                                 int    height,
+                                                int    windowWidth,
+                                                int    windowHeight,
                                                 int    originX,
                                                 int    originY,
                                                 int    depth,
                                                 int    bitsPerPixel,
+                                                int    transportDepth,
+                                                unsigned int fbFlags,
                                                 uint32_t *retRedMask,
                                                 uint32_t *retGreenMask,
                                                 uint32_t *retBlueMask);
 
+/* Creates a screen in the background, so screens come up concurrently.
+ * Takes the arguments of NestedClientCreateScreen. */
+NestedClientPendingPtr NestedClientStartScreen(NestedClientBackendPtr backend,
+                                               int    scrnIndex,
+                                               char  *displayName,
+                                               int    width,
+                                               int    height,
+                                               int    windowWidth,
+                                               int    windowHeight,
+                                               int    originX,
+                                               int    originY,
+                                               int    depth,
+                                               int    bitsPerPixel,
+                                               int    transportDepth,
+                                               unsigned int fbFlags);
+
+/* Waits for a screen started by NestedClientStartScreen and returns it,
+ * or NULL if it couldn't be created */
+NestedClientPrivatePtr NestedClientFinishScreen(NestedClientPendingPtr pending,
+                                                uint32_t *retRedMask,
+                                                uint32_t *retGreenMask,
+                                                uint32_t *retBlueMask);
+
+/* Shows the given part of a framebuffer the driver allocated in a window
+ * of its own; input is posted through inputOwner's device if given */
+NestedClientPrivatePtr NestedClientCreateTile(NestedClientBackendPtr backend,
+                                              int    scrnIndex,
+                                              char  *displayName,
+                                              char  *fb,
+                                              int    fbStride,
+                                              int    x,
+                                              int    y,
+                                              int    width,
+                                              int    height,
+                                              int    originX,
+                                              int    originY,
+                                              int    depth,
+                                              int    bitsPerPixel,
+                                              int    transportDepth,
+                                              NestedClientPrivatePtr inputOwner);
+
 char *NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv);
 
+/* Moves uploads to a thread of their own, so a slow host only delays
+ * itself; returns FALSE if the thread can't be started */
+Bool NestedClientSetAsync(NestedClientPrivatePtr pPriv);
+
 void NestedClientUpdateScreen(NestedClientPrivatePtr pPriv,
-                              int16_t x1,
-                              int16_t y1,
-                              int16_t x2,
-                              int16_t y2);
+                              int    x1,
+                              int    y1,
+                              int    x2,
+                              int    y2);
+
+void NestedClientSetColor(NestedClientPrivatePtr pPriv, int index,
+                          uint16_t red, uint16_t green, uint16_t blue);
+
+void NestedClientUpdatePalette(NestedClientPrivatePtr pPriv);
+
+/* Lets large conversions run on the given threads; NULL disables them */
+void NestedClientSetWorkers(NestedClientPrivatePtr pPriv,
+                            NestedWorkersPtr workers);
+
+/* Counts uploads, round trips and events into the screen's page; NULL
+ * stops counting */
+void NestedClientSetStats(NestedClientPrivatePtr pPriv, NestedStatsPtr stats);
+
+void NestedClientReleaseFrameBuffer(NestedClientPrivatePtr pPriv,
+                                    int height);
+
+void NestedClientSetViewport(NestedClientPrivatePtr pPriv, int x, int y);
+
+void NestedClientResizeWindow(NestedClientPrivatePtr pPriv, int width, int height);
+
+void NestedClientSetResizeHandler(NestedClientPrivatePtr pPriv,
+                                  NestedClientResizeProc proc,
+                                  void *data);
 
 void NestedClientHideCursor(NestedClientPrivatePtr pPriv);
 
+void NestedClientSetParked(NestedClientPrivatePtr pPriv, Bool parked);
+
 void NestedClientCheckEvents(NestedClientPrivatePtr pPriv);
 
+/* Does the work host events asked for that is too heavy for the input path,
+ * which may run from a signal handler. Only call from the main loop. */
+void NestedClientProcessDeferred(NestedClientPrivatePtr pPriv);
+
 void NestedClientCloseScreen(NestedClientPrivatePtr pPriv);
 
 void NestedClientSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev);
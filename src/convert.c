@@ -0,0 +1,792 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "convert.h"
+
+#if defined(__GNUC__) && defined(HAVE_IMMINTRIN_H) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define NESTED_CONVERT_X86 1
+#include <immintrin.h>
+#define NESTED_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* Kernels are written per row; this builds the rectangle version */
+#define NESTED_CONVERT_RECT(name, row)                                  \
+static void                                                             \
+name(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,    \
+     int width, int height) {                                           \
+    while (height-- > 0) {                                              \
+        row(src, dst, width);                                           \
+        src += srcStride;                                               \
+        dst += dstStride;                                               \
+    }                                                                   \
+}
+
+static const struct {
+    NestedFormat format;
+    int bitsPerPixel;
+    uint32_t red, green, blue;
+    const char *name;
+} nestedFormats[] = {
+    { NESTED_FORMAT_C8,           8, 0,          0,          0,          "c8" },
+    { NESTED_FORMAT_R5G6B5,      16, 0xf800,     0x07e0,     0x001f,     "r5g6b5" },
+    { NESTED_FORMAT_B5G6R5,      16, 0x001f,     0x07e0,     0xf800,     "b5g6r5" },
+    { NESTED_FORMAT_X8R8G8B8,    32, 0xff0000,   0x00ff00,   0x0000ff,   "x8r8g8b8" },
+    { NESTED_FORMAT_X8B8G8R8,    32, 0x0000ff,   0x00ff00,   0xff0000,   "x8b8g8r8" },
+    { NESTED_FORMAT_X2R10G10B10, 32, 0x3ff00000, 0x000ffc00, 0x000003ff, "x2r10g10b10" },
+    { NESTED_FORMAT_X2B10G10R10, 32, 0x000003ff, 0x000ffc00, 0x3ff00000, "x2b10g10r10" },
+};
+
+#define NUM_FORMATS (sizeof(nestedFormats) / sizeof(nestedFormats[0]))
+
+NestedFormat
+NestedFormatFromMasks(int bitsPerPixel, uint32_t redMask,
+                      uint32_t greenMask, uint32_t blueMask) {
+    size_t i;
+
+    /* Indexed formats have no masks; a PseudoColor host isn't supported */
+    if (!redMask || !greenMask || !blueMask)
+        return NESTED_FORMAT_UNKNOWN;
+
+    for (i = 0; i < NUM_FORMATS; i++)
+        if (nestedFormats[i].bitsPerPixel == bitsPerPixel &&
+            nestedFormats[i].red == redMask &&
+            nestedFormats[i].green == greenMask &&
+            nestedFormats[i].blue == blueMask)
+            return nestedFormats[i].format;
+
+    return NESTED_FORMAT_UNKNOWN;
+}
+
+/* The format we use for the nested framebuffer at a given depth */
+NestedFormat
+NestedFormatForDepth(int depth, int bitsPerPixel) {
+    if (depth == 8 && bitsPerPixel == 8)
+        return NESTED_FORMAT_C8;
+    if (depth == 16 && bitsPerPixel == 16)
+        return NESTED_FORMAT_R5G6B5;
+    if (depth == 24 && bitsPerPixel == 32)
+        return NESTED_FORMAT_X8R8G8B8;
+    if (depth == 30 && bitsPerPixel == 32)
+        return NESTED_FORMAT_X2R10G10B10;
+
+    return NESTED_FORMAT_UNKNOWN;
+}
+
+void
+NestedFormatGetMasks(NestedFormat format, uint32_t *redMask,
+                     uint32_t *greenMask, uint32_t *blueMask) {
+    size_t i;
+
+    *redMask = *greenMask = *blueMask = 0;
+
+    for (i = 0; i < NUM_FORMATS; i++)
+        if (nestedFormats[i].format == format) {
+            *redMask = nestedFormats[i].red;
+            *greenMask = nestedFormats[i].green;
+            *blueMask = nestedFormats[i].blue;
+        }
+}
+
+int
+NestedFormatBitsPerPixel(NestedFormat format) {
+    size_t i;
+
+    for (i = 0; i < NUM_FORMATS; i++)
+        if (nestedFormats[i].format == format)
+            return nestedFormats[i].bitsPerPixel;
+
+    return 0;
+}
+
+const char *
+NestedFormatName(NestedFormat format) {
+    size_t i;
+
+    for (i = 0; i < NUM_FORMATS; i++)
+        if (nestedFormats[i].format == format)
+            return nestedFormats[i].name;
+
+    return "unknown";
+}
+
+/*
+ * Portable kernels. Channels are widened by replicating their top bits, so
+ * full intensity stays full intensity, and narrowed by truncation.
+ */
+
+static inline uint16_t
+nested_8888_to_565(uint32_t p) {
+    return ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+}
+
+static inline uint32_t
+nested_565_to_8888(uint32_t p) {
+    return 0xff000000 |
+           ((p & 0xf800) << 8) | ((p & 0xe000) << 3) |
+           ((p & 0x07e0) << 5) | ((p & 0x0600) >> 1) |
+           ((p & 0x001f) << 3) | ((p & 0x001c) >> 2);
+}
+
+static inline uint32_t
+nested_8888_to_2101010(uint32_t p) {
+    return 0xc0000000 |
+           ((p & 0xff0000) << 6) | ((p & 0xc00000) >> 2) |
+           ((p & 0x00ff00) << 4) | ((p & 0x00c000) >> 4) |
+           ((p & 0x0000ff) << 2) | ((p & 0x0000c0) >> 6);
+}
+
+static inline uint32_t
+nested_2101010_to_8888(uint32_t p) {
+    return 0xff000000 |
+           ((p >> 6) & 0xff0000) | ((p >> 4) & 0x00ff00) | ((p >> 2) & 0x0000ff);
+}
+
+static inline uint32_t
+nested_swap_rb(uint32_t p) {
+    return 0xff000000 | (p & 0x0000ff00) |
+           ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+}
+
+static void
+nested_row_8888_to_565_c(const void *src, void *dst, int width) {
+    const uint32_t *s = src;
+    uint16_t *d = dst;
+    int i;
+
+    for (i = 0; i < width; i++)
+        d[i] = nested_8888_to_565(s[i]);
+}
+
+static void
+nested_row_565_to_8888_c(const void *src, void *dst, int width) {
+    const uint16_t *s = src;
+    uint32_t *d = dst;
+    int i;
+
+    for (i = 0; i < width; i++)
+        d[i] = nested_565_to_8888(s[i]);
+}
+
+static void
+nested_row_8888_to_2101010_c(const void *src, void *dst, int width) {
+    const uint32_t *s = src;
+    uint32_t *d = dst;
+    int i;
+
+    for (i = 0; i < width; i++)
+        d[i] = nested_8888_to_2101010(s[i]);
+}
+
+static void
+nested_row_2101010_to_8888_c(const void *src, void *dst, int width) {
+    const uint32_t *s = src;
+    uint32_t *d = dst;
+    int i;
+
+    for (i = 0; i < width; i++)
+        d[i] = nested_2101010_to_8888(s[i]);
+}
+
+static void
+nested_row_swap_rb_c(const void *src, void *dst, int width) {
+    const uint32_t *s = src;
+    uint32_t *d = dst;
+    int i;
+
+    for (i = 0; i < width; i++)
+        d[i] = nested_swap_rb(s[i]);
+}
+
+NESTED_CONVERT_RECT(nested_8888_to_565_c, nested_row_8888_to_565_c)
+NESTED_CONVERT_RECT(nested_565_to_8888_c, nested_row_565_to_8888_c)
+NESTED_CONVERT_RECT(nested_8888_to_2101010_c, nested_row_8888_to_2101010_c)
+NESTED_CONVERT_RECT(nested_2101010_to_8888_c, nested_row_2101010_to_8888_c)
+NESTED_CONVERT_RECT(nested_swap_rb_c, nested_row_swap_rb_c)
+
+/* Palette expansion has its own rectangle wrapper, as rows need the table */
+#define NESTED_EXPAND_RECT(name, row)                                   \
+static void                                                             \
+name(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,    \
+     int width, int height, const uint32_t *palette) {                  \
+    while (height-- > 0) {                                              \
+        row(src, dst, width, palette);                                  \
+        src += srcStride;                                               \
+        dst += dstStride;                                               \
+    }                                                                   \
+}
+
+static void
+nested_row_c8_to_16_c(const uint8_t *src, void *dst, int width,
+                      const uint32_t *palette) {
+    uint16_t *d = dst;
+    int i;
+
+    for (i = 0; i < width; i++)
+        d[i] = palette[src[i]];
+}
+
+static void
+nested_row_c8_to_32_c(const uint8_t *src, void *dst, int width,
+                      const uint32_t *palette) {
+    uint32_t *d = dst;
+    int i;
+
+    for (i = 0; i < width; i++)
+        d[i] = palette[src[i]];
+}
+
+NESTED_EXPAND_RECT(nested_c8_to_16_c, nested_row_c8_to_16_c)
+NESTED_EXPAND_RECT(nested_c8_to_32_c, nested_row_c8_to_32_c)
+
+#ifdef NESTED_CONVERT_X86
+
+/*
+ * SSE2 kernels: 8 pixels per iteration, the tail is left to the portable
+ * code.
+ */
+
+NESTED_TARGET("sse2") static inline __m128i
+nested_pack_565_sse2(__m128i p) {
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+    __m128i v = _mm_or_si128(_mm_or_si128(r, g), b);
+
+    /* Sign-extend so the saturating pack keeps the 16 bit pattern */
+    return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+NESTED_TARGET("sse2") static inline __m128i
+nested_expand_565_sse2(__m128i p) {
+    __m128i v = _mm_set1_epi32(0xff000000);
+
+    v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xf800)), 8));
+    v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xe000)), 3));
+    v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x07e0)), 5));
+    v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x0600)), 1));
+    v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x001f)), 3));
+    v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x001c)), 2));
+    return v;
+}
+
+NESTED_TARGET("sse2") static inline __m128i
+nested_vec_8888_to_2101010_sse2(__m128i p) {
+    __m128i v = _mm_set1_epi32(0xc0000000);
+
+    v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xff0000)), 6));
+    v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xc00000)), 2));
+    v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x00ff00)), 4));
+    v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x00c000)), 4));
+    v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x0000ff)), 2));
+    v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x0000c0)), 6));
+    return v;
+}
+
+NESTED_TARGET("sse2") static inline __m128i
+nested_vec_2101010_to_8888_sse2(__m128i p) {
+    __m128i v = _mm_set1_epi32(0xff000000);
+
+    v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(p, 6), _mm_set1_epi32(0xff0000)));
+    v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(p, 4), _mm_set1_epi32(0x00ff00)));
+    v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(p, 2), _mm_set1_epi32(0x0000ff)));
+    return v;
+}
+
+NESTED_TARGET("sse2") static inline __m128i
+nested_vec_swap_rb_sse2(__m128i p) {
+    __m128i ag = _mm_or_si128(_mm_and_si128(p, _mm_set1_epi32(0x0000ff00)),
+                              _mm_set1_epi32(0xff000000));
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xff));
+    __m128i b = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xff)), 16);
+
+    return _mm_or_si128(ag, _mm_or_si128(r, b));
+}
+
+NESTED_TARGET("sse2") static void
+nested_row_8888_to_565_sse2(const void *src, void *dst, int width) {
+    const uint32_t *s = src;
+    uint16_t *d = dst;
+    int i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+        __m128i a = nested_pack_565_sse2(_mm_loadu_si128((const __m128i *)(s + i)));
+        __m128i b = nested_pack_565_sse2(_mm_loadu_si128((const __m128i *)(s + i + 4)));
+
+        _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(a, b));
+    }
+
+    nested_row_8888_to_565_c(s + i, d + i, width - i);
+}
+
+NESTED_TARGET("sse2") static void
+nested_row_565_to_8888_sse2(const void *src, void *dst, int width) {
+    const uint16_t *s = src;
+    uint32_t *d = dst;
+    __m128i zero = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(s + i));
+
+        _mm_storeu_si128((__m128i *)(d + i),
+                         nested_expand_565_sse2(_mm_unpacklo_epi16(p, zero)));
+        _mm_storeu_si128((__m128i *)(d + i + 4),
+                         nested_expand_565_sse2(_mm_unpackhi_epi16(p, zero)));
+    }
+
+    nested_row_565_to_8888_c(s + i, d + i, width - i);
+}
+
+#define NESTED_ROW_32_SSE2(name, op, tail)                              \
+NESTED_TARGET("sse2") static void                                       \
+name(const void *src, void *dst, int width) {                           \
+    const uint32_t *s = src;                                            \
+    uint32_t *d = dst;                                                  \
+    int i;                                                              \
+                                                                        \
+    for (i = 0; i + 8 <= width; i += 8) {                               \
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));          \
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 4));      \
+                                                                        \
+        _mm_storeu_si128((__m128i *)(d + i), op(a));                    \
+        _mm_storeu_si128((__m128i *)(d + i + 4), op(b));                \
+    }                                                                   \
+                                                                        \
+    tail(s + i, d + i, width - i);                                      \
+}
+
+NESTED_ROW_32_SSE2(nested_row_8888_to_2101010_sse2,
+                   nested_vec_8888_to_2101010_sse2, nested_row_8888_to_2101010_c)
+NESTED_ROW_32_SSE2(nested_row_2101010_to_8888_sse2,
+                   nested_vec_2101010_to_8888_sse2, nested_row_2101010_to_8888_c)
+NESTED_ROW_32_SSE2(nested_row_swap_rb_sse2,
+                   nested_vec_swap_rb_sse2, nested_row_swap_rb_c)
+
+NESTED_CONVERT_RECT(nested_8888_to_565_sse2, nested_row_8888_to_565_sse2)
+NESTED_CONVERT_RECT(nested_565_to_8888_sse2, nested_row_565_to_8888_sse2)
+NESTED_CONVERT_RECT(nested_8888_to_2101010_sse2, nested_row_8888_to_2101010_sse2)
+NESTED_CONVERT_RECT(nested_2101010_to_8888_sse2, nested_row_2101010_to_8888_sse2)
+NESTED_CONVERT_RECT(nested_swap_rb_sse2, nested_row_swap_rb_sse2)
+
+/*
+ * AVX2 kernels: 16 pixels per iteration.
+ */
+
+NESTED_TARGET("avx2") static inline __m256i
+nested_pack_565_avx2(__m256i p) {
+    __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xf800));
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07e0));
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x001f));
+    __m256i v = _mm256_or_si256(_mm256_or_si256(r, g), b);
+
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+NESTED_TARGET("avx2") static inline __m256i
+nested_expand_565_avx2(__m256i p) {
+    __m256i v = _mm256_set1_epi32(0xff000000);
+
+    v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0xf800)), 8));
+    v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0xe000)), 3));
+    v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x07e0)), 5));
+    v = _mm256_or_si256(v, _mm256_srli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x0600)), 1));
+    v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x001f)), 3));
+    v = _mm256_or_si256(v, _mm256_srli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x001c)), 2));
+    return v;
+}
+
+NESTED_TARGET("avx2") static inline __m256i
+nested_vec_8888_to_2101010_avx2(__m256i p) {
+    __m256i v = _mm256_set1_epi32(0xc0000000);
+
+    v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0xff0000)), 6));
+    v = _mm256_or_si256(v, _mm256_srli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0xc00000)), 2));
+    v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x00ff00)), 4));
+    v = _mm256_or_si256(v, _mm256_srli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x00c000)), 4));
+    v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x0000ff)), 2));
+    v = _mm256_or_si256(v, _mm256_srli_epi32(_mm256_and_si256(p, _mm256_set1_epi32(0x0000c0)), 6));
+    return v;
+}
+
+NESTED_TARGET("avx2") static inline __m256i
+nested_vec_2101010_to_8888_avx2(__m256i p) {
+    __m256i v = _mm256_set1_epi32(0xff000000);
+
+    v = _mm256_or_si256(v, _mm256_and_si256(_mm256_srli_epi32(p, 6), _mm256_set1_epi32(0xff0000)));
+    v = _mm256_or_si256(v, _mm256_and_si256(_mm256_srli_epi32(p, 4), _mm256_set1_epi32(0x00ff00)));
+    v = _mm256_or_si256(v, _mm256_and_si256(_mm256_srli_epi32(p, 2), _mm256_set1_epi32(0x0000ff)));
+    return v;
+}
+
+NESTED_TARGET("avx2") static inline __m256i
+nested_vec_swap_rb_avx2(__m256i p) {
+    const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+                                             10, 9, 8, 11, 14, 13, 12, 15,
+                                             2, 1, 0, 3, 6, 5, 4, 7,
+                                             10, 9, 8, 11, 14, 13, 12, 15);
+
+    return _mm256_or_si256(_mm256_shuffle_epi8(p, shuffle),
+                           _mm256_set1_epi32(0xff000000));
+}
+
+NESTED_TARGET("avx2") static void
+nested_row_8888_to_565_avx2(const void *src, void *dst, int width) {
+    const uint32_t *s = src;
+    uint16_t *d = dst;
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+        __m256i a = nested_pack_565_avx2(_mm256_loadu_si256((const __m256i *)(s + i)));
+        __m256i b = nested_pack_565_avx2(_mm256_loadu_si256((const __m256i *)(s + i + 8)));
+
+        /* The pack works per 128 bit lane; put the quarters back in order */
+        _mm256_storeu_si256((__m256i *)(d + i),
+                            _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b),
+                                                     0xd8));
+    }
+
+    nested_row_8888_to_565_c(s + i, d + i, width - i);
+}
+
+NESTED_TARGET("avx2") static void
+nested_row_565_to_8888_avx2(const void *src, void *dst, int width) {
+    const uint16_t *s = src;
+    uint32_t *d = dst;
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 8));
+
+        _mm256_storeu_si256((__m256i *)(d + i),
+                            nested_expand_565_avx2(_mm256_cvtepu16_epi32(a)));
+        _mm256_storeu_si256((__m256i *)(d + i + 8),
+                            nested_expand_565_avx2(_mm256_cvtepu16_epi32(b)));
+    }
+
+    nested_row_565_to_8888_c(s + i, d + i, width - i);
+}
+
+#define NESTED_ROW_32_AVX2(name, op, tail)                              \
+NESTED_TARGET("avx2") static void                                       \
+name(const void *src, void *dst, int width) {                           \
+    const uint32_t *s = src;                                            \
+    uint32_t *d = dst;                                                  \
+    int i;                                                              \
+                                                                        \
+    for (i = 0; i + 16 <= width; i += 16) {                             \
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));       \
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + 8));   \
+                                                                        \
+        _mm256_storeu_si256((__m256i *)(d + i), op(a));                 \
+        _mm256_storeu_si256((__m256i *)(d + i + 8), op(b));             \
+    }                                                                   \
+                                                                        \
+    tail(s + i, d + i, width - i);                                      \
+}
+
+NESTED_ROW_32_AVX2(nested_row_8888_to_2101010_avx2,
+                   nested_vec_8888_to_2101010_avx2, nested_row_8888_to_2101010_c)
+NESTED_ROW_32_AVX2(nested_row_2101010_to_8888_avx2,
+                   nested_vec_2101010_to_8888_avx2, nested_row_2101010_to_8888_c)
+NESTED_ROW_32_AVX2(nested_row_swap_rb_avx2,
+                   nested_vec_swap_rb_avx2, nested_row_swap_rb_c)
+
+NESTED_CONVERT_RECT(nested_8888_to_565_avx2, nested_row_8888_to_565_avx2)
+NESTED_CONVERT_RECT(nested_565_to_8888_avx2, nested_row_565_to_8888_avx2)
+NESTED_CONVERT_RECT(nested_8888_to_2101010_avx2, nested_row_8888_to_2101010_avx2)
+NESTED_CONVERT_RECT(nested_2101010_to_8888_avx2, nested_row_2101010_to_8888_avx2)
+NESTED_CONVERT_RECT(nested_swap_rb_avx2, nested_row_swap_rb_avx2)
+
+/* SSE2 has no gather, so palette expansion only has an AVX2 kernel */
+NESTED_TARGET("avx2") static inline __m256i
+nested_gather_c8_avx2(const uint8_t *src, const uint32_t *palette) {
+    __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src));
+
+    return _mm256_i32gather_epi32((const int *)palette, idx, 4);
+}
+
+NESTED_TARGET("avx2") static void
+nested_row_c8_to_16_avx2(const uint8_t *src, void *dst, int width,
+                         const uint32_t *palette) {
+    uint16_t *d = dst;
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+        __m256i a = nested_gather_c8_avx2(src + i, palette);
+        __m256i b = nested_gather_c8_avx2(src + i + 8, palette);
+
+        /* Entries fit in 16 bits, so the saturating pack is exact */
+        _mm256_storeu_si256((__m256i *)(d + i),
+                            _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b),
+                                                     0xd8));
+    }
+
+    nested_row_c8_to_16_c(src + i, d + i, width - i, palette);
+}
+
+NESTED_TARGET("avx2") static void
+nested_row_c8_to_32_avx2(const uint8_t *src, void *dst, int width,
+                         const uint32_t *palette) {
+    uint32_t *d = dst;
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+        _mm256_storeu_si256((__m256i *)(d + i),
+                            nested_gather_c8_avx2(src + i, palette));
+        _mm256_storeu_si256((__m256i *)(d + i + 8),
+                            nested_gather_c8_avx2(src + i + 8, palette));
+    }
+
+    nested_row_c8_to_32_c(src + i, d + i, width - i, palette);
+}
+
+NESTED_EXPAND_RECT(nested_c8_to_16_avx2, nested_row_c8_to_16_avx2)
+NESTED_EXPAND_RECT(nested_c8_to_32_avx2, nested_row_c8_to_32_avx2)
+
+#endif /* NESTED_CONVERT_X86 */
+
+static const struct {
+    NestedFormat src;
+    NestedFormat dst;
+    NestedConvertProc c;
+#ifdef NESTED_CONVERT_X86
+    NestedConvertProc sse2;
+    NestedConvertProc avx2;
+#endif
+} nestedKernels[] = {
+#ifdef NESTED_CONVERT_X86
+#define NESTED_KERNEL(src, dst, name) \
+    { src, dst, name##_c, name##_sse2, name##_avx2 }
+#else
+#define NESTED_KERNEL(src, dst, name) \
+    { src, dst, name##_c }
+#endif
+    NESTED_KERNEL(NESTED_FORMAT_X8R8G8B8, NESTED_FORMAT_R5G6B5,
+                  nested_8888_to_565),
+    NESTED_KERNEL(NESTED_FORMAT_R5G6B5, NESTED_FORMAT_X8R8G8B8,
+                  nested_565_to_8888),
+    NESTED_KERNEL(NESTED_FORMAT_X8R8G8B8, NESTED_FORMAT_X2R10G10B10,
+                  nested_8888_to_2101010),
+    NESTED_KERNEL(NESTED_FORMAT_X2R10G10B10, NESTED_FORMAT_X8R8G8B8,
+                  nested_2101010_to_8888),
+    NESTED_KERNEL(NESTED_FORMAT_X8R8G8B8, NESTED_FORMAT_X8B8G8R8,
+                  nested_swap_rb),
+    NESTED_KERNEL(NESTED_FORMAT_X8B8G8R8, NESTED_FORMAT_X8R8G8B8,
+                  nested_swap_rb),
+#undef NESTED_KERNEL
+};
+
+#define NUM_KERNELS (sizeof(nestedKernels) / sizeof(nestedKernels[0]))
+
+/* Same format on both sides, e.g. for tiles of a shared framebuffer */
+#define NESTED_COPY_RECT(name, bytes)                                   \
+static void                                                             \
+name(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,    \
+     int width, int height) {                                           \
+    while (height-- > 0) {                                              \
+        memcpy(dst, src, width * (bytes));                              \
+        src += srcStride;                                               \
+        dst += dstStride;                                               \
+    }                                                                   \
+}
+
+NESTED_COPY_RECT(nested_copy_16, 2)
+NESTED_COPY_RECT(nested_copy_32, 4)
+
+static int
+nested_expand_init(NestedConverter *conv) {
+    int i;
+
+    if (NestedFormatBitsPerPixel(conv->dst) == 16)
+        conv->expand = nested_c8_to_16_c;
+    else
+        conv->expand = nested_c8_to_32_c;
+    conv->isa = "C";
+
+#ifdef NESTED_CONVERT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        conv->expand = NestedFormatBitsPerPixel(conv->dst) == 16 ?
+                       nested_c8_to_16_avx2 : nested_c8_to_32_avx2;
+        conv->isa = "AVX2";
+    }
+#endif
+
+    /* Start out black until the palette is loaded */
+    for (i = 0; i < 256; i++)
+        NestedConvertSetColor(conv, i, 0, 0, 0);
+
+    return 1;
+}
+
+int
+NestedConvertInit(NestedConverter *conv, NestedFormat src,
+                  NestedFormat dst) {
+    size_t i;
+
+    if (src == NESTED_FORMAT_UNKNOWN || dst == NESTED_FORMAT_UNKNOWN ||
+        dst == NESTED_FORMAT_C8)
+        return 0;
+
+    conv->src = src;
+    conv->dst = dst;
+    conv->proc = NULL;
+    conv->expand = NULL;
+    conv->isa = "generic";
+
+    if (src == NESTED_FORMAT_C8)
+        return nested_expand_init(conv);
+
+    if (src == dst) {
+        conv->proc = NestedFormatBitsPerPixel(src) == 16 ?
+                     nested_copy_16 : nested_copy_32;
+        conv->isa = "memcpy";
+        return 1;
+    }
+
+    for (i = 0; i < NUM_KERNELS; i++) {
+        if (nestedKernels[i].src != src || nestedKernels[i].dst != dst)
+            continue;
+
+        conv->proc = nestedKernels[i].c;
+        conv->isa = "C";
+
+#ifdef NESTED_CONVERT_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2")) {
+            conv->proc = nestedKernels[i].avx2;
+            conv->isa = "AVX2";
+        } else if (__builtin_cpu_supports("sse2")) {
+            conv->proc = nestedKernels[i].sse2;
+            conv->isa = "SSE2";
+        }
+#endif
+        break;
+    }
+
+    return 1;
+}
+
+/*
+ * Fallback for pairs without a dedicated kernel: every channel goes
+ * through a 16 bit intermediate. It rounds like the kernels, so a pair
+ * gives the same pixels whichever path converts it.
+ */
+
+static inline uint32_t
+nested_get_channel(uint32_t pixel, uint32_t mask) {
+    int bits = __builtin_popcount(mask);
+    uint32_t value = (pixel & mask) >> __builtin_ctz(mask);
+    uint32_t wide = 0;
+    int shift;
+
+    for (shift = 16 - bits; shift > -bits; shift -= bits)
+        wide |= shift >= 0 ? value << shift : value >> -shift;
+
+    return wide;
+}
+
+static inline uint32_t
+nested_put_channel(uint32_t value, uint32_t mask) {
+    return (value >> (16 - __builtin_popcount(mask))) << __builtin_ctz(mask);
+}
+
+void
+NestedConvertSetColor(NestedConverter *conv, int index, uint16_t red,
+                      uint16_t green, uint16_t blue) {
+    uint32_t r, g, b, p;
+
+    NestedFormatGetMasks(conv->dst, &r, &g, &b);
+
+    p = nested_put_channel(red, r) |
+        nested_put_channel(green, g) |
+        nested_put_channel(blue, b);
+
+    if (NestedFormatBitsPerPixel(conv->dst) == 32)
+        p |= ~(r | g | b);
+
+    conv->palette[index & 0xff] = p;
+}
+
+static void
+nested_convert_generic(const NestedConverter *conv,
+                       const uint8_t *src, int srcStride,
+                       uint8_t *dst, int dstStride,
+                       int width, int height) {
+    uint32_t sr, sg, sb, dr, dg, db, p;
+    int srcBpp = NestedFormatBitsPerPixel(conv->src);
+    int dstBpp = NestedFormatBitsPerPixel(conv->dst);
+    int x;
+
+    NestedFormatGetMasks(conv->src, &sr, &sg, &sb);
+    NestedFormatGetMasks(conv->dst, &dr, &dg, &db);
+
+    while (height-- > 0) {
+        for (x = 0; x < width; x++) {
+            if (srcBpp == 16)
+                p = ((const uint16_t *)src)[x];
+            else
+                p = ((const uint32_t *)src)[x];
+
+            p = nested_put_channel(nested_get_channel(p, sr), dr) |
+                nested_put_channel(nested_get_channel(p, sg), dg) |
+                nested_put_channel(nested_get_channel(p, sb), db);
+
+            if (dstBpp == 16)
+                ((uint16_t *)dst)[x] = p;
+            else
+                ((uint32_t *)dst)[x] = p | ~(dr | dg | db);
+        }
+
+        src += srcStride;
+        dst += dstStride;
+    }
+}
+
+void
+NestedConvertRect(const NestedConverter *conv,
+                  const uint8_t *src, int srcStride,
+                  uint8_t *dst, int dstStride,
+                  int x, int y, int width, int height) {
+    src += y * srcStride + x * NestedFormatBitsPerPixel(conv->src) / 8;
+    dst += y * dstStride + x * NestedFormatBitsPerPixel(conv->dst) / 8;
+
+    if (conv->expand)
+        conv->expand(src, srcStride, dst, dstStride, width, height,
+                     conv->palette);
+    else if (conv->proc)
+        conv->proc(src, srcStride, dst, dstStride, width, height);
+    else
+        nested_convert_generic(conv, src, srcStride, dst, dstStride,
+                               width, height);
+}
@@ -0,0 +1,87 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Pixel format conversion between the nested framebuffer and the host
+ * image, used when the two formats don't match. */
+
+#ifndef NESTED_CONVERT_H
+#define NESTED_CONVERT_H
+
+#include <stdint.h>
+
+typedef enum {
+    NESTED_FORMAT_UNKNOWN,
+    NESTED_FORMAT_C8, /* 8 bit palette indices */
+    NESTED_FORMAT_R5G6B5,
+    NESTED_FORMAT_B5G6R5,
+    NESTED_FORMAT_X8R8G8B8,
+    NESTED_FORMAT_X8B8G8R8,
+    NESTED_FORMAT_X2R10G10B10,
+    NESTED_FORMAT_X2B10G10R10
+} NestedFormat;
+
+typedef void (*NestedConvertProc)(const uint8_t *src, int srcStride,
+                                  uint8_t *dst, int dstStride,
+                                  int width, int height);
+
+/* Expands palette indices through a lookup table of destination pixels */
+typedef void (*NestedExpandProc)(const uint8_t *src, int srcStride,
+                                 uint8_t *dst, int dstStride,
+                                 int width, int height,
+                                 const uint32_t *palette);
+
+typedef struct {
+    NestedFormat src;
+    NestedFormat dst;
+    NestedConvertProc proc; /* NULL: generic, mask based conversion */
+    NestedExpandProc expand; /* for NESTED_FORMAT_C8 sources */
+    const char *isa; /* instruction set of the kernel, for the log */
+    uint32_t palette[256]; /* in the destination format */
+} NestedConverter;
+
+NestedFormat NestedFormatFromMasks(int bitsPerPixel, uint32_t redMask,
+                                   uint32_t greenMask, uint32_t blueMask);
+
+NestedFormat NestedFormatForDepth(int depth, int bitsPerPixel);
+
+void NestedFormatGetMasks(NestedFormat format, uint32_t *redMask,
+                          uint32_t *greenMask, uint32_t *blueMask);
+
+int NestedFormatBitsPerPixel(NestedFormat format);
+
+const char *NestedFormatName(NestedFormat format);
+
+/* Picks the fastest kernel the CPU supports; returns 0 if the pair can't
+ * be converted. */
+int NestedConvertInit(NestedConverter *conv, NestedFormat src,
+                      NestedFormat dst);
+
+/* Sets a palette entry of a NESTED_FORMAT_C8 converter; channels are 16
+ * bit, like X colors. */
+void NestedConvertSetColor(NestedConverter *conv, int index, uint16_t red,
+                           uint16_t green, uint16_t blue);
+
+void NestedConvertRect(const NestedConverter *conv,
+                       const uint8_t *src, int srcStride,
+                       uint8_t *dst, int dstStride,
+                       int x, int y, int width, int height);
+
+#endif /* NESTED_CONVERT_H */
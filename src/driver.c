@@ -31,24 +31,43 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/select.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
 #include <xorg-server.h>
+#include <dixstruct.h>
 #include <fb.h>
 #include <micmap.h>
 #include <mipointer.h>
 #include <shadow.h>
 #include <xf86.h>
+#include <xf86cmap.h>
 #include <xf86Module.h>
 #include <xf86str.h>
 #include "xf86Xinput.h"
 
+#ifdef RANDR
+#include <randrstr.h>
+#endif
+
+#ifdef HAVE_XEXTPROTO_71
+#include <X11/extensions/dpmsconst.h>
+#else
+#define DPMS_SERVER
+#include <X11/extensions/dpms.h>
+#endif
+
 #include "compat-api.h"
 
 #include "client.h"
+#include "convert.h"
+#include "fbmem.h"
+#include "stats.h"
+#include "probes.h"
+#include "trace.h"
 #include "nested_input.h"
 
 #define NESTED_VERSION 0
@@ -61,6 +80,8 @@
 
 #define TIMER_CALLBACK_INTERVAL 20
 
+#define NESTED_PIXELS_TO_MM(pixels, dpi) (((pixels) * 254 + (dpi) * 5) / ((dpi) * 10))
+
 static MODULESETUPPROTO(NestedSetup);
 static void NestedIdentify(int flags);
 static const OptionInfoRec *NestedAvailableOptions(int chipid, int busid);
@@ -80,7 +101,12 @@ static ModeStatus NestedValidMode(SCRN_ARG_TYPE arg, DisplayModePtr mode,
                                   Bool verbose, int flags);
 
 static Bool NestedSaveScreen(ScreenPtr pScreen, int mode);
+#ifdef DPMSExtension
+static void NestedDPMSSet(ScrnInfoPtr pScrn, int mode, int flags);
+#endif
 static Bool NestedCreateScreenResources(ScreenPtr pScreen);
+static void NestedLoadPalette(ScrnInfoPtr pScrn, int numColors, int *indices,
+                              LOCO *colors, VisualPtr pVisual);
 
 static void NestedShadowUpdate(ScreenPtr pScreen, shadowBufPtr pBuf);
 static Bool NestedCloseScreen(CLOSE_SCREEN_ARGS_DECL);
@@ -96,7 +122,18 @@ void NestedPrintMode(ScrnInfoPtr p, DisplayModePtr m);
 typedef enum {
     OPTION_DISPLAY,
     OPTION_XAUTHORITY,
-    OPTION_ORIGIN
+    OPTION_ORIGIN,
+    OPTION_TRANSPORT_DEPTH,
+    OPTION_UPDATE_THREADS,
+    OPTION_HUGE_PAGES,
+    OPTION_LOCK_FRAMEBUFFER,
+    OPTION_TILES,
+    OPTION_TILE_DISPLAYS,
+    OPTION_MIRROR_DISPLAYS,
+    OPTION_BACKEND,
+    OPTION_STATS,
+    OPTION_DAMAGE_TRACE,
+    OPTION_DAMAGE_TRACE_PIXELS
 } NestedOpts;
 
 typedef enum {
@@ -115,6 +152,17 @@ static OptionInfoRec NestedOptions[] = {
     { OPTION_DISPLAY, "Display", OPTV_STRING, {0}, FALSE },
     { OPTION_XAUTHORITY, "Xauthority", OPTV_STRING, {0}, FALSE },
     { OPTION_ORIGIN,  "Origin",  OPTV_STRING, {0}, FALSE },
+    { OPTION_TRANSPORT_DEPTH, "TransportDepth", OPTV_INTEGER, {0}, FALSE },
+    { OPTION_UPDATE_THREADS, "UpdateThreads", OPTV_INTEGER, {0}, FALSE },
+    { OPTION_HUGE_PAGES, "HugePages", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_LOCK_FRAMEBUFFER, "LockFramebuffer", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_TILES, "Tiles", OPTV_STRING, {0}, FALSE },
+    { OPTION_TILE_DISPLAYS, "TileDisplays", OPTV_STRING, {0}, FALSE },
+    { OPTION_MIRROR_DISPLAYS, "MirrorDisplays", OPTV_STRING, {0}, FALSE },
+    { OPTION_BACKEND, "Backend", OPTV_STRING, {0}, FALSE },
+    { OPTION_STATS, "Stats", OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_DAMAGE_TRACE, "DamageTrace", OPTV_STRING, {0}, FALSE },
+    { OPTION_DAMAGE_TRACE_PIXELS, "DamageTracePixels", OPTV_BOOLEAN, {0}, FALSE },
     { -1,             NULL,      OPTV_NONE,   {0}, FALSE }
 };
 
@@ -162,16 +210,57 @@ _X_EXPORT XF86ModuleData nestedModuleData = {
     NULL, /* teardown */
 };
 
+/* A host window showing one cell of a tiled screen */
+typedef struct NestedTile {
+    NestedClientPrivatePtr       clientData;
+    BoxRec                       box; /* in screen coordinates */
+    int                          fd; /* general socket, -1 if none */
+} NestedTile, *NestedTilePtr;
+
 /* These stuff should be valid to all server generations */
 typedef struct NestedPrivate {
+    NestedClientBackendPtr       backend;
     char                        *displayName;
     char                        *xauthority;
     int                          originX;
     int                          originY;
-    NestedClientPrivatePtr       clientData;
+    int                          maxWidth;  /* size the framebuffer is */
+    int                          maxHeight; /* allocated with */
+    int                          transportDepth; /* 0: the host's */
+    int                          updateThreads; /* 1: main thread only */
+    NestedWorkersPtr             workers;
+    unsigned int                 fbFlags; /* NESTED_FB_* */
+    int                          tileColumns; /* 1x1: a single window */
+    int                          tileRows;
+    char                       **tileDisplays; /* cycled through */
+    int                          numTileDisplays;
+    char                       **mirrorDisplays; /* one window each */
+    int                          numMirrorDisplays;
+    NestedTilePtr                tiles; /* NULL if not tiled */
+    int                          numTiles;
+    char                        *fb; /* shared by the tiles */
+    size_t                       fbMapSize;
+    NestedClientPrivatePtr       clientData; /* the first tile if tiled;
+                                              * kept across generations */
+    Pixel                        redMask; /* of clientData's format */
+    Pixel                        greenMask;
+    Pixel                        blueMask;
+    NestedClientPendingPtr       pending; /* being created since PreInit */
+    NestedStatsPtr               stats; /* NULL if not kept */
+    char                        *tracePath; /* NULL if not recording */
+    Bool                         tracePixels;
+    NestedTracePtr               trace; /* opened by the first ScreenInit */
     CreateScreenResourcesProcPtr CreateScreenResources;
     CloseScreenProcPtr           CloseScreen;
     ShadowUpdateProc             update;
+    Bool                         blanked; /* by the screen saver */
+    Bool                         dpmsOff; /* by DPMS */
+    Bool                         parked;
+    DisplayModePtr               hostMode; /* follows the host window's
+                                            * size; NULL until resized */
+    volatile Bool                hostResized; /* applied in BlockHandler */
+    int                          hostWidth;
+    int                          hostHeight;
 } NestedPrivate, *NestedPrivatePtr;
 
 #define PNESTED(p)    ((NestedPrivatePtr)((p)->driverPrivate))
@@ -272,8 +361,22 @@ NestedDriverFunc(ScrnInfoPtr pScrn, xorgDriverFuncOp op, pointer ptr) {
             return TRUE;
 
         case RR_GET_INFO:
+            ((xorgRRRotation *)ptr)->RRRotations = RR_Rotate_0;
+            return TRUE;
+
         case RR_SET_CONFIG:
-        case RR_GET_MODE_MM:
+            return ((xorgRRRotation *)ptr)->RRConfig.rotation == RR_Rotate_0;
+
+        case RR_GET_MODE_MM: {
+            xorgRRModeMM *modeMM = ptr;
+
+            modeMM->mmWidth = NESTED_PIXELS_TO_MM(modeMM->mode->HDisplay,
+                                                  pScrn->xDpi);
+            modeMM->mmHeight = NESTED_PIXELS_TO_MM(modeMM->mode->VDisplay,
+                                                   pScrn->yDpi);
+            return TRUE;
+        }
+
         default:
             return FALSE;
     }
@@ -303,10 +406,54 @@ static void NestedFreePrivate(ScrnInfoPtr pScrn) {
     pScrn->driverPrivate = NULL;
 }
 
+/* Splits a display list option into its names; NULL if it isn't set */
+static char **
+NestedSplitDisplays(ScrnInfoPtr pScrn, int option, int *count) {
+    char *list, *name, **names;
+
+    *count = 0;
+    if (!xf86IsOptionSet(NestedOptions, option))
+        return NULL;
+
+    list = XNFstrdup(xf86GetOptValString(NestedOptions, option));
+    names = XNFcalloc((strlen(list) / 2 + 1) * sizeof(char *));
+
+    for (name = strtok(list, " \t,"); name; name = strtok(NULL, " \t,")) {
+        xf86DrvMsg(pScrn->scrnIndex, X_CONFIG, "Using display \"%s\" for %s\n",
+                   name, option == OPTION_MIRROR_DISPLAYS ? "a mirror" :
+                                                            "tiles");
+        names[(*count)++] = name;
+    }
+
+    if (!*count) {
+        free(list);
+        free(names);
+        return NULL;
+    }
+
+    return names;
+}
+
+static void
+NestedFreeDisplays(char **names) {
+    if (names) {
+        free(names[0]);
+        free(names);
+    }
+}
+
+/* Mirrors are shown the same way as tiles covering the whole screen */
+static Bool
+NestedIsTiled(NestedPrivatePtr pNested) {
+    return pNested->tileColumns * pNested->tileRows > 1 ||
+           pNested->numMirrorDisplays > 0;
+}
+
 /* Data from here is valid to all server generations */
 static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
     NestedPrivatePtr pNested;
     char *originString = NULL;
+    char *tilesString, *backendName;
 
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedPreInit\n");
 
@@ -335,6 +482,10 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
     if (!xf86SetDefaultVisual(pScrn, -1))
         return FALSE;
 
+    /* Palette entries are expanded to at least 8 bits per channel */
+    if (pScrn->depth == 8)
+        pScrn->rgbBits = 8;
+
     pScrn->monitor = pScrn->confScreen->monitor; /* XXX */
 
     xf86CollectOptions(pScrn, NULL);
@@ -357,7 +508,7 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
                    pNested->xauthority);
         setenv("XAUTHORITY", pNested->xauthority, 1);
     } else {
-        pNested->displayName = NULL;
+        pNested->xauthority = NULL;
     }
 
     if (xf86IsOptionSet(NestedOptions, OPTION_ORIGIN)) {
@@ -375,15 +526,85 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
         pNested->originY = 0;
     }
 
+    pNested->transportDepth = 0;
+    if (xf86GetOptValInteger(NestedOptions, OPTION_TRANSPORT_DEPTH,
+                             &pNested->transportDepth)) {
+        if (pNested->transportDepth != 16 && pNested->transportDepth != 24) {
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                       "Invalid value for option \"TransportDepth\"\n");
+            return FALSE;
+        }
+        xf86DrvMsg(pScrn->scrnIndex, X_CONFIG, "Using transport depth %d\n",
+                   pNested->transportDepth);
+    }
+
+    pNested->updateThreads = 1;
+    if (xf86GetOptValInteger(NestedOptions, OPTION_UPDATE_THREADS,
+                             &pNested->updateThreads)) {
+        if (pNested->updateThreads < 1) {
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                       "Invalid value for option \"UpdateThreads\"\n");
+            return FALSE;
+        }
+        xf86DrvMsg(pScrn->scrnIndex, X_CONFIG, "Using %d update threads\n",
+                   pNested->updateThreads);
+    }
+
+    pNested->fbFlags = 0;
+    if (xf86ReturnOptValBool(NestedOptions, OPTION_HUGE_PAGES, FALSE))
+        pNested->fbFlags |= NESTED_FB_HUGE_PAGES;
+    if (xf86ReturnOptValBool(NestedOptions, OPTION_LOCK_FRAMEBUFFER, FALSE))
+        pNested->fbFlags |= NESTED_FB_LOCKED;
+
+    pNested->tileColumns = 1;
+    pNested->tileRows = 1;
+    if (xf86IsOptionSet(NestedOptions, OPTION_TILES)) {
+        tilesString = xf86GetOptValString(NestedOptions, OPTION_TILES);
+        if (sscanf(tilesString, "%dx%d", &pNested->tileColumns,
+                   &pNested->tileRows) != 2 ||
+            pNested->tileColumns < 1 || pNested->tileRows < 1) {
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                       "Invalid value for option \"Tiles\"\n");
+            return FALSE;
+        }
+        xf86DrvMsg(pScrn->scrnIndex, X_CONFIG, "Using %dx%d tiles\n",
+                   pNested->tileColumns, pNested->tileRows);
+    }
+
+    /* Tiles without a display of their own use the screen's */
+    pNested->tileDisplays = NestedSplitDisplays(pScrn, OPTION_TILE_DISPLAYS,
+                                                &pNested->numTileDisplays);
+    pNested->mirrorDisplays = NestedSplitDisplays(pScrn,
+                                                  OPTION_MIRROR_DISPLAYS,
+                                                  &pNested->numMirrorDisplays);
+
+    pNested->backend = NestedClientFindBackend(NULL);
+    if (xf86IsOptionSet(NestedOptions, OPTION_BACKEND)) {
+        backendName = xf86GetOptValString(NestedOptions, OPTION_BACKEND);
+        if (!xf86NameCmp(backendName, "auto"))
+            pNested->backend = NestedClientProbeBackend(pScrn->scrnIndex,
+                                                        pNested->displayName,
+                                                        pScrn->depth);
+        else
+            pNested->backend = NestedClientFindBackend(backendName);
+        if (!pNested->backend) {
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                       "No usable backend \"%s\"\n", backendName);
+            return FALSE;
+        }
+        xf86DrvMsg(pScrn->scrnIndex, X_CONFIG, "Using the %s backend\n",
+                   pNested->backend->name);
+    }
+
     xf86ShowUnusedOptions(pScrn->scrnIndex, pScrn->options);
 
-    if (!NestedClientCheckDisplay(NULL)) {
+    if (!NestedClientCheckDisplay(pNested->backend, pNested->displayName)) {
         xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Can't open display: %s\n",
                    pNested->displayName);
         return FALSE;
     }
 
-    if (!NestedClientValidDepth(pScrn->depth)) {
+    if (!NestedClientValidDepth(pNested->backend, pScrn->depth)) {
         xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Invalid depth: %d\n",
                    pScrn->depth);
         return FALSE;
@@ -405,6 +626,11 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
         xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "No valid modes found\n");
         return FALSE;
     }
+
+    /* The framebuffer is allocated once at this size; mode switches and
+     * host window resizes only change the visible part of it. */
+    pNested->maxWidth = pScrn->virtualX;
+    pNested->maxHeight = pScrn->virtualY;
     xf86SetCrtcForModes(pScrn, 0);
 
     pScrn->currentMode = pScrn->modes;
@@ -418,6 +644,60 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
 
     pScrn->memPhysBase = 0;
     pScrn->fbOffset = 0;
+
+    if (pNested->tileColumns > pNested->maxWidth ||
+        pNested->tileRows > pNested->maxHeight) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Too many tiles for %dx%d\n",
+                   pNested->maxWidth, pNested->maxHeight);
+        return FALSE;
+    }
+
+    pNested->tracePath = NULL;
+    pNested->trace = NULL;
+    if (xf86IsOptionSet(NestedOptions, OPTION_DAMAGE_TRACE)) {
+        pNested->tracePath = xf86GetOptValString(NestedOptions,
+                                                 OPTION_DAMAGE_TRACE);
+        pNested->tracePixels = xf86ReturnOptValBool(NestedOptions,
+                                                    OPTION_DAMAGE_TRACE_PIXELS,
+                                                    FALSE);
+        xf86DrvMsg(pScrn->scrnIndex, X_CONFIG,
+                   "Recording damage%s to \"%s\"\n",
+                   pNested->tracePixels ? " and its pixels" : "",
+                   pNested->tracePath);
+    }
+
+    pNested->stats = NULL;
+    if (xf86ReturnOptValBool(NestedOptions, OPTION_STATS, FALSE)) {
+        pNested->stats = NestedStatsCreate(pScrn->scrnIndex,
+                                           pNested->backend->name,
+                                           pNested->displayName);
+        if (!pNested->stats)
+            xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                       "Failed to create the statistics page\n");
+    }
+
+    /* Tiles are created in ScreenInit, once the framebuffer exists */
+    pNested->tiles = NULL;
+    pNested->numTiles = 0;
+    pNested->pending = NULL;
+    if (NestedIsTiled(pNested))
+        return TRUE;
+
+    /* Everything the host screen needs is known now: set it up while the
+     * other screens are initialised, ScreenInit just collects it. */
+    pNested->pending = NestedClientStartScreen(pNested->backend,
+                                               pScrn->scrnIndex,
+                                               pNested->displayName,
+                                               pNested->maxWidth,
+                                               pNested->maxHeight,
+                                               pScrn->currentMode->HDisplay,
+                                               pScrn->currentMode->VDisplay,
+                                               pNested->originX,
+                                               pNested->originY,
+                                               pScrn->depth,
+                                               pScrn->bitsPerPixel,
+                                               pNested->transportDepth,
+                                               pNested->fbFlags);
     
     return TRUE;
 }
@@ -541,18 +821,285 @@ NestedAddMode(ScrnInfoPtr pScrn, int width, int height) {
 // to force the initialization to wait until the input core is initialized.
 static CARD32
 NestedMouseTimer(OsTimerPtr timer, CARD32 time, pointer arg) {
-    NestedInputLoadDriver(arg);
+    ScrnInfoPtr pScrn = arg;
+
+    NestedInputLoadDriver(PCLIENTDATA(pScrn), PNESTED(pScrn)->stats);
     return 0;
 }
 
+static void NestedApplyHostSize(ScrnInfoPtr pScrn);
+
 static void
 NestedBlockHandler(pointer data, OSTimePtr wt, pointer LastSelectMask) {
-    NestedClientPrivatePtr pNestedClient = data;
-    NestedClientCheckEvents(pNestedClient);
+    ScrnInfoPtr pScrn = data;
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int i;
+
+    /* While parked, host events are only read when the input device's
+     * file descriptor wakes us up. */
+    if (!pNested->parked) {
+        if (pNested->tiles)
+            for (i = 0; i < pNested->numTiles; i++)
+                NestedClientCheckEvents(pNested->tiles[i].clientData);
+        else
+            NestedClientCheckEvents(pNested->clientData);
+    }
+
+    /* Events read on the input path leave their heavier work for here */
+    if (pNested->tiles)
+        for (i = 0; i < pNested->numTiles; i++)
+            NestedClientProcessDeferred(pNested->tiles[i].clientData);
+    else
+        NestedClientProcessDeferred(pNested->clientData);
+
+    if (pNested->hostResized)
+        NestedApplyHostSize(pScrn);
 }
 
 static void
 NestedWakeupHandler(pointer data, int i, pointer LastSelectMask) {
+    ScrnInfoPtr pScrn = data;
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int n;
+
+    if (i <= 0)
+        return;
+
+    /* Nobody else reads the sockets of the other tiles' hosts */
+    for (n = 1; n < pNested->numTiles; n++)
+        if (pNested->tiles[n].fd >= 0 &&
+            FD_ISSET(pNested->tiles[n].fd, (fd_set *)LastSelectMask))
+            NestedClientCheckEvents(pNested->tiles[n].clientData);
+}
+
+/* Returns the mode with the given size. Sizes without one share a single
+ * mode that is changed in place, so resizing the host window doesn't grow
+ * the mode list. */
+static DisplayModePtr
+NestedGetMode(ScrnInfoPtr pScrn, int width, int height) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    DisplayModePtr mode = pScrn->modes;
+
+    do {
+        if (mode != pNested->hostMode &&
+            mode->HDisplay == width && mode->VDisplay == height)
+            return mode;
+
+        mode = mode->next;
+    } while (mode != pScrn->modes);
+
+    if (pNested->hostMode) {
+        free(pNested->hostMode->name);
+        pNested->hostMode->name = XNFprintf("%dx%d", width, height);
+        pNested->hostMode->HDisplay = width;
+        pNested->hostMode->VDisplay = height;
+        return pNested->hostMode;
+    }
+
+    if (!NestedAddMode(pScrn, width, height))
+        return NULL;
+
+    /* NestedAddMode appends to a non-circular list; close it again */
+    pScrn->modes->prev->next = pScrn->modes;
+    pNested->hostMode = pScrn->modes->prev;
+    return pNested->hostMode;
+}
+
+/* Follows the host window with the current mode. The virtual size is
+ * kept, so a window smaller than it pans over the screen; xf86SwitchMode
+ * moves the viewport to keep the pointer in it. */
+static void
+NestedApplyHostSize(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int width, height;
+    DisplayModePtr mode;
+
+    pNested->hostResized = FALSE;
+    width = pNested->hostWidth;
+    height = pNested->hostHeight;
+
+    if (pScrn->currentMode->HDisplay == width &&
+        pScrn->currentMode->VDisplay == height)
+        return;
+
+    mode = NestedGetMode(pScrn, width, height);
+    if (!mode)
+        return;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Switching to the host's %dx%d\n",
+               width, height);
+
+    if (!xf86SwitchMode(xf86ScrnToScreen(pScrn), mode))
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Failed to switch mode\n");
+}
+
+/* Called while reading host events, which may happen in a signal handler
+ * or the input thread: only note the size for the block handler */
+static void
+NestedHostResized(void *data, int width, int height) {
+    ScrnInfoPtr pScrn = data;
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+
+    pNested->hostWidth = min(width, pScrn->virtualX);
+    pNested->hostHeight = min(height, pScrn->virtualY);
+    pNested->hostResized = TRUE;
+}
+
+static void
+NestedDestroyTiles(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int i;
+
+    for (i = 0; i < pNested->numTiles; i++) {
+        if (pNested->tiles[i].fd >= 0)
+            RemoveGeneralSocket(pNested->tiles[i].fd);
+        if (pNested->tiles[i].clientData)
+            NestedClientCloseScreen(pNested->tiles[i].clientData);
+    }
+
+    free(pNested->tiles);
+    pNested->tiles = NULL;
+    pNested->numTiles = 0;
+    pNested->clientData = NULL;
+
+    if (pNested->fb)
+        NestedFbUnmap(pNested->fb, pNested->fbMapSize);
+    pNested->fb = NULL;
+}
+
+/* Closes the host windows and connections, once the server is exiting */
+static void
+NestedCloseClients(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+
+    if (pNested->tiles)
+        NestedDestroyTiles(pScrn);
+    else if (pNested->clientData)
+        NestedClientCloseScreen(pNested->clientData);
+
+    pNested->clientData = NULL;
+}
+
+/* Between server generations the host windows stay up showing the last
+ * frame, and only drop what belonged to the old screen. */
+static void
+NestedDetachClients(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    NestedClientPrivatePtr clientData;
+    int i;
+
+    for (i = 0; i < (pNested->tiles ? pNested->numTiles : 1); i++) {
+        clientData = pNested->tiles ? pNested->tiles[i].clientData :
+                                      pNested->clientData;
+
+        /* The input devices are freed before the screens are closed; the
+         * next generation's device is set once it is loaded */
+        NestedClientSetDevicePtr(clientData, NULL);
+        NestedClientSetWorkers(clientData, NULL);
+        if (pNested->parked)
+            NestedClientSetParked(clientData, FALSE);
+    }
+
+    pNested->parked = FALSE;
+}
+
+/* Splits the framebuffer into a grid of host windows, followed by one
+ * window per mirror display. The framebuffer is ours so each tile only
+ * uploads its own part of it; the first tile owns the input device and the
+ * others post their events through it. */
+static Bool
+NestedCreateTiles(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int stride = ((pNested->maxWidth * pScrn->bitsPerPixel + 31) / 32) * 4;
+    int tileWidth = (pNested->maxWidth + pNested->tileColumns - 1) /
+                    pNested->tileColumns;
+    int tileHeight = (pNested->maxHeight + pNested->tileRows - 1) /
+                     pNested->tileRows;
+    int numGrid = pNested->tileColumns * pNested->tileRows;
+    size_t pageSize;
+    NestedTilePtr tile;
+    char *displayName;
+    int i;
+
+    pNested->fb = NestedFbMap((size_t)stride * pNested->maxHeight,
+                              pNested->fbFlags, &pNested->fbMapSize,
+                              &pageSize);
+    if (!pNested->fb)
+        return FALSE;
+
+    pNested->numTiles = numGrid + pNested->numMirrorDisplays;
+    pNested->tiles = calloc(pNested->numTiles, sizeof(NestedTile));
+    if (!pNested->tiles) {
+        NestedDestroyTiles(pScrn);
+        return FALSE;
+    }
+
+    for (i = 0; i < pNested->numTiles; i++)
+        pNested->tiles[i].fd = -1;
+
+    for (i = 0; i < pNested->numTiles; i++) {
+        tile = &pNested->tiles[i];
+
+        if (i < numGrid) {
+            tile->box.x1 = (i % pNested->tileColumns) * tileWidth;
+            tile->box.y1 = (i / pNested->tileColumns) * tileHeight;
+            tile->box.x2 = min(tile->box.x1 + tileWidth, pNested->maxWidth);
+            tile->box.y2 = min(tile->box.y1 + tileHeight, pNested->maxHeight);
+            displayName = pNested->numTileDisplays ?
+                          pNested->tileDisplays[i % pNested->numTileDisplays] :
+                          pNested->displayName;
+        } else {
+            tile->box.x1 = 0;
+            tile->box.y1 = 0;
+            tile->box.x2 = pNested->maxWidth;
+            tile->box.y2 = pNested->maxHeight;
+            displayName = pNested->mirrorDisplays[i - numGrid];
+        }
+
+        /* Rounding up can leave nothing for the last row or column */
+        if (tile->box.x1 >= tile->box.x2 || tile->box.y1 >= tile->box.y2) {
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Tile %d is empty\n", i);
+            NestedDestroyTiles(pScrn);
+            return FALSE;
+        }
+
+        tile->clientData = NestedClientCreateTile(pNested->backend,
+                                                  pScrn->scrnIndex,
+                                                  displayName, pNested->fb,
+                                                  stride, tile->box.x1,
+                                                  tile->box.y1,
+                                                  tile->box.x2 - tile->box.x1,
+                                                  tile->box.y2 - tile->box.y1,
+                                                  pNested->originX + tile->box.x1,
+                                                  pNested->originY + tile->box.y1,
+                                                  pScrn->depth,
+                                                  pScrn->bitsPerPixel,
+                                                  pNested->transportDepth,
+                                                  i ? pNested->tiles[0].clientData
+                                                    : NULL);
+        if (!tile->clientData) {
+            NestedDestroyTiles(pScrn);
+            return FALSE;
+        }
+
+        /* Damage is fanned out to the mirrors, which upload it on their
+         * own threads so a slow host only falls behind by itself */
+        if (i >= numGrid && !NestedClientSetAsync(tile->clientData))
+            xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                       "Mirror on \"%s\" uploads synchronously\n",
+                       displayName);
+
+        /* The first tile's connection is read by the input device; other
+         * host connections only need to wake us up. */
+        if (i > 0) {
+            tile->fd = NestedClientGetFileDescriptor(tile->clientData);
+            if (tile->fd >= 0)
+                AddGeneralSocket(tile->fd);
+        }
+    }
+
+    pNested->clientData = pNested->tiles[0].clientData;
+    return TRUE;
 }
 
 /* Called at each server generation */
@@ -561,12 +1108,17 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
     ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
     NestedPrivatePtr pNested;
     Pixel redMask, greenMask, blueMask;
+    int i;
 
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedScreenInit\n");
 
     pNested = PNESTED(pScrn);
     /*NESTEDScrn = pScrn;*/
 
+    /* A previous generation may have shrunk the screen */
+    pScrn->virtualX = pNested->maxWidth;
+    pScrn->virtualY = pNested->maxHeight;
+
     NestedPrintPscreen(pScrn);
 
     /* Save state:
@@ -574,24 +1126,115 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
     
     //Load_Nested_Mouse();
 
-    pNested->clientData = NestedClientCreateScreen(pScrn->scrnIndex,
-                                                   NULL,
-                                                   pScrn->virtualX,
-                                                   pScrn->virtualY,
-                                                   pNested->originX,
-                                                   pNested->originY,
-                                                   pScrn->depth,
-                                                   pScrn->bitsPerPixel,
-                                                   &redMask, &greenMask, &blueMask);
+    if (pNested->clientData) {
+        /* Kept from the previous server generation: the host window,
+         * connection and framebuffer are reused as they are */
+        redMask = pNested->redMask;
+        greenMask = pNested->greenMask;
+        blueMask = pNested->blueMask;
+
+        if (!pNested->tiles)
+            NestedClientResizeWindow(pNested->clientData,
+                                     pScrn->currentMode->HDisplay,
+                                     pScrn->currentMode->VDisplay);
+    } else if (NestedIsTiled(pNested)) {
+        uint32_t masks[3];
+
+        if (!NestedCreateTiles(pScrn)) {
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Failed to create tiles\n");
+            return FALSE;
+        }
+
+        NestedFormatGetMasks(NestedFormatForDepth(pScrn->depth,
+                                                  pScrn->bitsPerPixel),
+                             &masks[0], &masks[1], &masks[2]);
+        redMask = masks[0];
+        greenMask = masks[1];
+        blueMask = masks[2];
+    } else if (pNested->pending) {
+        /* Started in PreInit for the first server generation */
+        pNested->clientData = NestedClientFinishScreen(pNested->pending,
+                                                       &redMask, &greenMask,
+                                                       &blueMask);
+        pNested->pending = NULL;
+    } else {
+        pNested->clientData = NestedClientCreateScreen(pNested->backend,
+                                                       pScrn->scrnIndex,
+                                                       pNested->displayName,
+                                                       pScrn->virtualX,
+                                                       pScrn->virtualY,
+                                                       pScrn->currentMode->HDisplay,
+                                                       pScrn->currentMode->VDisplay,
+                                                       pNested->originX,
+                                                       pNested->originY,
+                                                       pScrn->depth,
+                                                       pScrn->bitsPerPixel,
+                                                       pNested->transportDepth,
+                                                       pNested->fbFlags,
+                                                       &redMask, &greenMask,
+                                                       &blueMask);
+    }
     
     if (!pNested->clientData) {
         xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Failed to create client screen\n");
         return FALSE;
     }
+
+    pNested->redMask = redMask;
+    pNested->greenMask = greenMask;
+    pNested->blueMask = blueMask;
     
+    /* One trace covers all server generations */
+    if (pNested->tracePath && !pNested->trace) {
+        pNested->trace = NestedTraceOpen(pNested->tracePath,
+                                         pNested->tracePixels,
+                                         pScrn->virtualX, pScrn->virtualY,
+                                         pScrn->depth, pScrn->bitsPerPixel,
+                                         redMask, greenMask, blueMask);
+        if (!pNested->trace)
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                       "Can't write damage trace \"%s\"\n",
+                       pNested->tracePath);
+    }
+
+    /* Tiles keep their size: the screen spans all of them */
+    if (!pNested->tiles)
+        NestedClientSetResizeHandler(pNested->clientData, NestedHostResized,
+                                     pScrn);
+
+    /* The main thread is one of the update threads */
+    pNested->workers = NULL;
+    if (pNested->updateThreads > 1) {
+        pNested->workers = NestedWorkersCreate(pNested->updateThreads - 1);
+
+        if (!pNested->workers)
+            xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                       "Failed to start update threads\n");
+        else if (NestedWorkersCount(pNested->workers) <
+                 pNested->updateThreads)
+            xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                       "Only started %d of %d update threads\n",
+                       NestedWorkersCount(pNested->workers),
+                       pNested->updateThreads);
+
+        if (pNested->tiles)
+            for (i = 0; i < pNested->numTiles; i++)
+                NestedClientSetWorkers(pNested->tiles[i].clientData,
+                                       pNested->workers);
+        else
+            NestedClientSetWorkers(pNested->clientData, pNested->workers);
+    }
+
+    if (pNested->tiles)
+        for (i = 0; i < pNested->numTiles; i++)
+            NestedClientSetStats(pNested->tiles[i].clientData,
+                                 pNested->stats);
+    else
+        NestedClientSetStats(pNested->clientData, pNested->stats);
+
     // Schedule the NestedInputLoadDriver function to load once the
     // input core is initialized.
-    TimerSet(NULL, 0, 1, NestedMouseTimer, pNested->clientData);
+    TimerSet(NULL, 0, 1, NestedMouseTimer, pScrn);
 
     miClearVisualTypes();
     if (!miSetVisualTypesAndMasks(pScrn->depth,
@@ -617,8 +1260,22 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
     if (!miCreateDefColormap(pScreen))
         return FALSE;
 
+    /* The palette is applied when the framebuffer is expanded for the host */
+    if (pScrn->depth == 8 &&
+        !xf86HandleColormaps(pScreen, 256, pScrn->rgbBits, NestedLoadPalette,
+                             NULL, CMAP_RELOAD_ON_MODE_SWITCH))
+        return FALSE;
+
     pNested->update = NestedShadowUpdate;
     pScreen->SaveScreen = NestedSaveScreen;
+    pNested->blanked = FALSE;
+    pNested->dpmsOff = FALSE;
+    pNested->parked = FALSE;
+    pNested->hostResized = FALSE;
+
+#ifdef DPMSExtension
+    xf86DPMSInit(pScreen, NestedDPMSSet, 0);
+#endif
 
     if (!shadowSetup(pScreen))
         return FALSE;
@@ -629,7 +1286,7 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
     pNested->CloseScreen = pScreen->CloseScreen;
     pScreen->CloseScreen = NestedCloseScreen;
 
-    RegisterBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, pNested->clientData);
+    RegisterBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, pScrn);
 
     return TRUE;
 }
@@ -656,41 +1313,231 @@ NestedCreateScreenResources(ScreenPtr pScreen) {
 
 static void
 NestedShadowUpdate(ScreenPtr pScreen, shadowBufPtr pBuf) {
+    NestedPrivatePtr pNested = PNESTED(xf86ScreenToScrn(pScreen));
     RegionPtr pRegion = DamageRegion(pBuf->pDamage);
-    NestedClientUpdateScreen(PCLIENTDATA(xf86ScreenToScrn(pScreen)),
-                             pRegion->extents.x1, pRegion->extents.y1,
-                             pRegion->extents.x2, pRegion->extents.y2);
+    uint64_t start = NestedStatsNow();
+    BoxPtr box, rects;
+    BoxRec extents;
+    int i, n;
+
+    /* Nothing is shown while parked; the whole screen is sent again when
+     * we wake up. */
+    if (pNested->parked)
+        return;
+
+    NESTED_PROBE6(damage, pScreen->myNum, RegionNumRects(pRegion),
+                  pRegion->extents.x1, pRegion->extents.y1,
+                  pRegion->extents.x2, pRegion->extents.y2);
+
+    if (pNested->stats) {
+        box = RegionRects(pRegion);
+        for (i = 0; i < RegionNumRects(pRegion); i++)
+            NESTED_STATS_ADD(pNested->stats, damageArea,
+                             (uint64_t)(box[i].x2 - box[i].x1) *
+                             (box[i].y2 - box[i].y1));
+        NESTED_STATS_ADD(pNested->stats, damageRects,
+                         RegionNumRects(pRegion));
+        NestedStatsDamaged(pNested->stats);
+    }
+
+    if (pNested->trace &&
+        !NestedTraceFrameAdd(pNested->trace, RegionRects(pRegion),
+                             RegionNumRects(pRegion),
+                             pBuf->pPixmap->devPrivate.ptr,
+                             pBuf->pPixmap->devKind)) {
+        xf86DrvMsg(pScreen->myNum, X_ERROR,
+                   "Failed to write damage trace, stopped recording\n");
+        NestedTraceClose(pNested->trace);
+        pNested->trace = NULL;
+        pNested->tracePath = NULL;
+    }
+
+    if (!pNested->tiles) {
+        NestedClientUpdateScreen(pNested->clientData,
+                                 pRegion->extents.x1, pRegion->extents.y1,
+                                 pRegion->extents.x2, pRegion->extents.y2);
+        NESTED_STATS_ADD(pNested->stats, updates, 1);
+        NESTED_STATS_TIME(pNested->stats, updateTime, start);
+        return;
+    }
+
+    /* Each tile only uploads the extents of the damage rectangles that
+     * fall in it, in its own coordinates */
+    rects = RegionRects(pRegion);
+    for (i = 0; i < pNested->numTiles; i++) {
+        box = &pNested->tiles[i].box;
+        extents.x1 = box->x2;
+        extents.y1 = box->y2;
+        extents.x2 = box->x1;
+        extents.y2 = box->y1;
+
+        for (n = 0; n < RegionNumRects(pRegion); n++) {
+            if (rects[n].x2 <= box->x1 || rects[n].x1 >= box->x2 ||
+                rects[n].y2 <= box->y1 || rects[n].y1 >= box->y2)
+                continue;
+
+            extents.x1 = min(extents.x1, max(rects[n].x1, box->x1));
+            extents.y1 = min(extents.y1, max(rects[n].y1, box->y1));
+            extents.x2 = max(extents.x2, min(rects[n].x2, box->x2));
+            extents.y2 = max(extents.y2, min(rects[n].y2, box->y2));
+        }
+
+        if (extents.x1 >= extents.x2 || extents.y1 >= extents.y2)
+            continue;
+
+        NestedClientUpdateScreen(pNested->tiles[i].clientData,
+                                 extents.x1 - box->x1, extents.y1 - box->y1,
+                                 extents.x2 - box->x1, extents.y2 - box->y1);
+    }
+
+    NESTED_STATS_ADD(pNested->stats, updates, 1);
+    NESTED_STATS_TIME(pNested->stats, updateTime, start);
+}
+
+static void
+NestedLogLatency(ScrnInfoPtr pScrn, const char *name,
+                 const NestedStatsHistogram *hist) {
+    if (!hist->count)
+        return;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Latency %s: p50 %llu us, p99 %llu us (%llu samples)\n", name,
+               (unsigned long long)NestedStatsPercentile(hist, 0.5),
+               (unsigned long long)NestedStatsPercentile(hist, 0.99),
+               (unsigned long long)hist->count);
 }
 
 static Bool
 NestedCloseScreen(CLOSE_SCREEN_ARGS_DECL) {
     ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedStatsPtr stats = PNESTED(pScrn)->stats;
 
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedCloseScreen\n");
 
+    /* Since the server started */
+    if (stats) {
+        NestedLogLatency(pScrn, "event to post", &stats->eventToPost);
+        NestedLogLatency(pScrn, "post to damage", &stats->postToDamage);
+        NestedLogLatency(pScrn, "damage to upload", &stats->damageToUpload);
+        NestedLogLatency(pScrn, "event to upload", &stats->eventToUpload);
+    }
+
     shadowRemove(pScreen, pScreen->GetScreenPixmap(pScreen));
 
-    RemoveBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, PNESTED(pScrn)->clientData);
-    NestedClientCloseScreen(PCLIENTDATA(pScrn));
+    RemoveBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, pScrn);
+    if (dispatchException & DE_TERMINATE)
+        NestedCloseClients(pScrn);
+    else
+        NestedDetachClients(pScrn);
+    NestedWorkersDestroy(PNESTED(pScrn)->workers);
+    PNESTED(pScrn)->workers = NULL;
 
     pScreen->CloseScreen = PNESTED(pScrn)->CloseScreen;
     return (*pScreen->CloseScreen)(CLOSE_SCREEN_ARGS);
 }
 
+/* Parks the screen while it is blanked by either the screen saver or DPMS,
+ * so an idle nested server does no rendering uploads or host polling. */
+static void
+NestedUpdateParked(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    Bool parked = pNested->blanked || pNested->dpmsOff;
+    int i;
+
+    if (parked == pNested->parked || !pNested->clientData)
+        return;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "%s low-power mode\n",
+               parked ? "Entering" : "Leaving");
+
+    pNested->parked = parked;
+
+    if (!pNested->tiles) {
+        NestedClientSetParked(pNested->clientData, parked);
+
+        if (!parked)
+            NestedClientUpdateScreen(pNested->clientData, 0, 0,
+                                     pScrn->virtualX, pScrn->virtualY);
+        return;
+    }
+
+    for (i = 0; i < pNested->numTiles; i++) {
+        NestedClientSetParked(pNested->tiles[i].clientData, parked);
+
+        if (!parked)
+            NestedClientUpdateScreen(pNested->tiles[i].clientData, 0, 0,
+                                     pNested->tiles[i].box.x2 -
+                                     pNested->tiles[i].box.x1,
+                                     pNested->tiles[i].box.y2 -
+                                     pNested->tiles[i].box.y1);
+    }
+}
+
 static Bool NestedSaveScreen(ScreenPtr pScreen, int mode) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+
     xf86DrvMsg(pScreen->myNum, X_INFO, "NestedSaveScreen\n");
+
+    PNESTED(pScrn)->blanked = !xf86IsUnblank(mode);
+    NestedUpdateParked(pScrn);
     return TRUE;
 }
 
+static void
+NestedLoadPalette(ScrnInfoPtr pScrn, int numColors, int *indices,
+                  LOCO *colors, VisualPtr pVisual) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    int max = (1 << pScrn->rgbBits) - 1;
+    int i, n;
+
+    for (n = 0; n < (pNested->tiles ? pNested->numTiles : 1); n++) {
+        NestedClientPrivatePtr clientData = pNested->tiles ?
+                                            pNested->tiles[n].clientData :
+                                            pNested->clientData;
+
+        for (i = 0; i < numColors; i++)
+            NestedClientSetColor(clientData, indices[i],
+                                 colors[indices[i]].red * 0xffff / max,
+                                 colors[indices[i]].green * 0xffff / max,
+                                 colors[indices[i]].blue * 0xffff / max);
+
+        NestedClientUpdatePalette(clientData);
+    }
+}
+
+#ifdef DPMSExtension
+static void NestedDPMSSet(ScrnInfoPtr pScrn, int mode, int flags) {
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedDPMSSet: %d\n", mode);
+
+    PNESTED(pScrn)->dpmsOff = mode != DPMSModeOn;
+    NestedUpdateParked(pScrn);
+}
+#endif
+
 static Bool NestedSwitchMode(SWITCH_MODE_ARGS_DECL) {
     SCRN_INFO_PTR(arg);
-    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedSwitchMode\n");
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedSwitchMode: %s\n", mode->name);
+
+    /* The tiles cover the whole framebuffer and can't follow a mode */
+    if (PNESTED(pScrn)->tiles) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Mode switching is not supported with tiles\n");
+        return FALSE;
+    }
+
+    if (PCLIENTDATA(pScrn))
+        NestedClientResizeWindow(PCLIENTDATA(pScrn), mode->HDisplay,
+                                 mode->VDisplay);
     return TRUE;
 }
 
+/* The host window only shows the current mode, so panning just moves the
+ * viewport the client uploads from. */
 static void NestedAdjustFrame(ADJUST_FRAME_ARGS_DECL) {
     SCRN_INFO_PTR(arg);
-    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedAdjustFrame\n");
+
+    if (PCLIENTDATA(pScrn) && !PNESTED(pScrn)->tiles)
+        NestedClientSetViewport(PCLIENTDATA(pScrn), x, y);
 }
 
 static Bool NestedEnterVT(VT_FUNC_ARGS_DECL) {
@@ -706,7 +1553,35 @@ static void NestedLeaveVT(VT_FUNC_ARGS_DECL) {
 
 static void NestedFreeScreen(FREE_SCREEN_ARGS_DECL) {
     SCRN_INFO_PTR(arg);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    NestedClientPrivatePtr clientData;
+    uint32_t redMask, greenMask, blueMask;
+
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedFreeScreen\n");
+
+    /* A screen that was set up in PreInit but never initialised */
+    if (pNested && pNested->pending) {
+        clientData = NestedClientFinishScreen(pNested->pending, &redMask,
+                                              &greenMask, &blueMask);
+        pNested->pending = NULL;
+
+        if (clientData)
+            NestedClientCloseScreen(clientData);
+    }
+
+    if (pNested) {
+        NestedCloseClients(pScrn);
+
+        NestedFreeDisplays(pNested->tileDisplays);
+        NestedFreeDisplays(pNested->mirrorDisplays);
+        pNested->tileDisplays = NULL;
+        pNested->mirrorDisplays = NULL;
+
+        NestedStatsDestroy(pNested->stats);
+        pNested->stats = NULL;
+        NestedTraceClose(pNested->trace);
+        pNested->trace = NULL;
+    }
 }
 
 static ModeStatus NestedValidMode(SCRN_ARG_TYPE arg, DisplayModePtr mode,
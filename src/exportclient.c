@@ -0,0 +1,682 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* A client backend for local consumers such as recorders: the
+ * framebuffer and a ring of damage records are shared with whoever
+ * connects to the screen's Unix socket, see nested_export.h. Its display
+ * name is the socket path. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memfd_create, accept4 */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "client.h"
+#include "convert.h"
+#include "fbmem.h"
+#include "nested_export.h"
+
+#include "nested_input.h"
+
+/* The socket gives away the screen's contents and input, so it lives in
+ * a directory only we can enter: $XDG_RUNTIME_DIR, or this one */
+#define NESTED_EXPORT_DIR  "/tmp/.nested-export-%u"
+#define NESTED_EXPORT_NAME "nested-export-%d"
+
+struct NestedClientPrivate {
+    NestedClientBackendPtr backend;
+    int scrnIndex;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int listenFd;
+    int clientFd; /* the consumer, -1 if none */
+    int epollFd; /* both sockets, for the input device to wait on */
+    int fbFd;
+    char *fb;
+    size_t fbSize;
+    int ringFd;
+    NestedExportRing *ring;
+    uint64_t sequence;
+    uint8_t input[sizeof(NestedExportInput)]; /* partial message */
+    size_t inputLength;
+    NestedStatsPtr stats; /* owned by the driver */
+    DeviceIntPtr dev;
+};
+
+struct NestedClientPendingScreen {
+    NestedClientBackendPtr backend;
+    NestedClientPrivatePtr pPriv;
+    uint32_t redMask, greenMask, blueMask;
+};
+
+static int
+NestedExportCreateMemory(const char *name, size_t size) {
+    int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create(name, MFD_CLOEXEC);
+#else
+    fd = open("/dev/shm", O_TMPFILE | O_RDWR | O_EXCL | O_CLOEXEC, 0600);
+#endif
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static Bool
+NestedExportCheckDisplay(char *displayName) {
+    return TRUE;
+}
+
+static Bool
+NestedExportValidDepth(int depth) {
+    return depth == 8 || depth == 16 || depth == 24 || depth == 30;
+}
+
+/* Only ever used when asked for */
+static int
+NestedExportProbe(char *displayName) {
+    return NESTED_TRANSPORT_NONE;
+}
+
+static void
+NestedExportPush(NestedClientPrivatePtr pPriv, uint32_t flags,
+                 int x1, int y1, int x2, int y2) {
+    NestedExportRing *ring = pPriv->ring;
+    uint64_t n = ring->head;
+    NestedExportRecord *rec = &ring->records[n % ring->numRecords];
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    __atomic_store_n(&rec->index, 0, __ATOMIC_RELEASE);
+    rec->sequence = ++pPriv->sequence;
+    rec->time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    rec->flags = flags;
+    rec->x1 = x1;
+    rec->y1 = y1;
+    rec->x2 = x2;
+    rec->y2 = y2;
+    __atomic_store_n(&rec->index, n + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, n + 1, __ATOMIC_RELEASE);
+}
+
+static void
+NestedExportCloseScreen(NestedClientPrivatePtr pPriv);
+
+/* Checks that a directory exists, is ours and closed to everyone else */
+static Bool
+NestedExportPrivateDir(const char *dir) {
+    struct stat st;
+
+    return lstat(dir, &st) == 0 && S_ISDIR(st.st_mode) &&
+           st.st_uid == geteuid() && (st.st_mode & 077) == 0;
+}
+
+static Bool
+NestedExportDefaultPath(NestedClientPrivatePtr pPriv, int scrnIndex) {
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    char dir[sizeof(pPriv->path)];
+
+    if (runtimeDir && NestedExportPrivateDir(runtimeDir)) {
+        snprintf(dir, sizeof(dir), "%s", runtimeDir);
+    } else {
+        snprintf(dir, sizeof(dir), NESTED_EXPORT_DIR,
+                 (unsigned int)geteuid());
+        if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+            return FALSE;
+        if (!NestedExportPrivateDir(dir)) {
+            xf86DrvMsg(scrnIndex, X_ERROR,
+                       "%s is not a private directory of ours\n", dir);
+            return FALSE;
+        }
+    }
+
+    return snprintf(pPriv->path, sizeof(pPriv->path), "%s/" NESTED_EXPORT_NAME,
+                    dir, scrnIndex) < (int)sizeof(pPriv->path);
+}
+
+/* Removes a socket left behind by an earlier server, and nothing else */
+static void
+NestedExportRemoveStale(const char *path) {
+    struct stat st;
+
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+        st.st_uid == geteuid())
+        unlink(path);
+}
+
+static NestedClientPrivatePtr
+NestedExportCreateScreen(int scrnIndex,
+                         char *displayName,
+                         int width,
+                         int height,
+                         int windowWidth,
+                         int windowHeight,
+                         int originX,
+                         int originY,
+                         int depth,
+                         int bitsPerPixel,
+                         int transportDepth,
+                         unsigned int fbFlags,
+                         uint32_t *retRedMask,
+                         uint32_t *retGreenMask,
+                         uint32_t *retBlueMask) {
+    NestedClientPrivatePtr pPriv;
+    NestedExportRing *ring;
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    int stride = ((width * bitsPerPixel + 31) / 32) * 4;
+
+    if (transportDepth)
+        xf86DrvMsg(scrnIndex, X_WARNING,
+                   "The export backend ignores \"TransportDepth\"\n");
+
+    pPriv = calloc(1, sizeof(struct NestedClientPrivate));
+    if (!pPriv)
+        return NULL;
+
+    pPriv->backend = &nestedExportBackend;
+    pPriv->scrnIndex = scrnIndex;
+    pPriv->listenFd = -1;
+    pPriv->clientFd = -1;
+    pPriv->epollFd = -1;
+    pPriv->fbFd = -1;
+    pPriv->ringFd = -1;
+
+    if (displayName) {
+        snprintf(pPriv->path, sizeof(pPriv->path), "%s", displayName);
+    } else if (!NestedExportDefaultPath(pPriv, scrnIndex)) {
+        xf86DrvMsg(scrnIndex, X_ERROR, "No place for the export socket\n");
+        NestedExportCloseScreen(pPriv);
+        return NULL;
+    }
+
+    pPriv->fbSize = (size_t)stride * height;
+    pPriv->fbFd = NestedExportCreateMemory("nested-fb", pPriv->fbSize);
+    pPriv->ringFd = NestedExportCreateMemory("nested-ring",
+                                             sizeof(NestedExportRing));
+    if (pPriv->fbFd < 0 || pPriv->ringFd < 0) {
+        xf86DrvMsg(scrnIndex, X_ERROR, "Can't create shared memory: %s\n",
+                   strerror(errno));
+        NestedExportCloseScreen(pPriv);
+        return NULL;
+    }
+
+    pPriv->fb = mmap(NULL, pPriv->fbSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     pPriv->fbFd, 0);
+    ring = mmap(NULL, sizeof(NestedExportRing), PROT_READ | PROT_WRITE,
+                MAP_SHARED, pPriv->ringFd, 0);
+    pPriv->ring = ring == MAP_FAILED ? NULL : ring;
+    if (pPriv->fb == MAP_FAILED || !pPriv->ring) {
+        if (pPriv->fb == MAP_FAILED)
+            pPriv->fb = NULL;
+        NestedExportCloseScreen(pPriv);
+        return NULL;
+    }
+
+    if ((fbFlags & NESTED_FB_LOCKED) &&
+        !NestedFbLock(pPriv->fb, pPriv->fbSize, getpagesize()))
+        xf86DrvMsg(scrnIndex, X_WARNING,
+                   "Failed to lock the framebuffer in memory\n");
+
+    NestedFormatGetMasks(NestedFormatForDepth(depth, bitsPerPixel),
+                         retRedMask, retGreenMask, retBlueMask);
+
+    ring->magic = NESTED_EXPORT_MAGIC;
+    ring->version = NESTED_EXPORT_VERSION;
+    ring->width = width;
+    ring->height = height;
+    ring->stride = stride;
+    ring->bitsPerPixel = bitsPerPixel;
+    ring->depth = depth;
+    ring->redMask = *retRedMask;
+    ring->greenMask = *retGreenMask;
+    ring->blueMask = *retBlueMask;
+    ring->viewWidth = windowWidth;
+    ring->viewHeight = windowHeight;
+    ring->numRecords = NESTED_EXPORT_RECORDS;
+
+    pPriv->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                             SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, pPriv->path, sizeof(addr.sun_path));
+    NestedExportRemoveStale(pPriv->path);
+
+    /* The mode of an unbound socket is the one bind gives its file */
+    if (pPriv->listenFd < 0 || fchmod(pPriv->listenFd, 0600) < 0 ||
+        bind(pPriv->listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        xf86DrvMsg(scrnIndex, X_ERROR, "Can't listen on %s: %s\n",
+                   pPriv->path, strerror(errno));
+        if (pPriv->listenFd >= 0)
+            close(pPriv->listenFd);
+        pPriv->listenFd = -1; /* the path isn't ours to unlink */
+        NestedExportCloseScreen(pPriv);
+        return NULL;
+    }
+
+    if (chmod(pPriv->path, 0600) < 0 || listen(pPriv->listenFd, 1) < 0) {
+        xf86DrvMsg(scrnIndex, X_ERROR, "Can't listen on %s: %s\n",
+                   pPriv->path, strerror(errno));
+        NestedExportCloseScreen(pPriv);
+        return NULL;
+    }
+
+    pPriv->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.fd = pPriv->listenFd;
+    if (pPriv->epollFd < 0 ||
+        epoll_ctl(pPriv->epollFd, EPOLL_CTL_ADD, pPriv->listenFd, &ev) < 0) {
+        NestedExportCloseScreen(pPriv);
+        return NULL;
+    }
+
+    xf86DrvMsg(scrnIndex, X_INFO, "Exporting %dx%d at %d bpp on %s\n",
+               width, height, bitsPerPixel, pPriv->path);
+    return pPriv;
+}
+
+/* Export screens are set up synchronously */
+static NestedClientPendingPtr
+NestedExportStartScreen(int scrnIndex,
+                        char *displayName,
+                        int width,
+                        int height,
+                        int windowWidth,
+                        int windowHeight,
+                        int originX,
+                        int originY,
+                        int depth,
+                        int bitsPerPixel,
+                        int transportDepth,
+                        unsigned int fbFlags) {
+    NestedClientPendingPtr pending;
+
+    pending = calloc(1, sizeof(struct NestedClientPendingScreen));
+    if (!pending)
+        return NULL;
+
+    pending->backend = &nestedExportBackend;
+    pending->pPriv = NestedExportCreateScreen(scrnIndex, displayName, width,
+                                              height, windowWidth,
+                                              windowHeight, originX, originY,
+                                              depth, bitsPerPixel,
+                                              transportDepth, fbFlags,
+                                              &pending->redMask,
+                                              &pending->greenMask,
+                                              &pending->blueMask);
+    return pending;
+}
+
+static NestedClientPrivatePtr
+NestedExportFinishScreen(NestedClientPendingPtr pending,
+                         uint32_t *retRedMask,
+                         uint32_t *retGreenMask,
+                         uint32_t *retBlueMask) {
+    NestedClientPrivatePtr pPriv = pending->pPriv;
+
+    *retRedMask = pending->redMask;
+    *retGreenMask = pending->greenMask;
+    *retBlueMask = pending->blueMask;
+    free(pending);
+
+    return pPriv;
+}
+
+/* A consumer can read any part of the framebuffer it wants */
+static NestedClientPrivatePtr
+NestedExportCreateTile(int scrnIndex,
+                       char *displayName,
+                       char *fb,
+                       int fbStride,
+                       int x,
+                       int y,
+                       int width,
+                       int height,
+                       int originX,
+                       int originY,
+                       int depth,
+                       int bitsPerPixel,
+                       int transportDepth,
+                       NestedClientPrivatePtr inputOwner) {
+    xf86DrvMsg(scrnIndex, X_ERROR,
+               "The export backend doesn't support tiles or mirrors\n");
+    return NULL;
+}
+
+static char *
+NestedExportGetFrameBuffer(NestedClientPrivatePtr pPriv) {
+    return pPriv->fb;
+}
+
+/* Nothing is uploaded, so nothing can block */
+static Bool
+NestedExportSetAsync(NestedClientPrivatePtr pPriv) {
+    return TRUE;
+}
+
+static void
+NestedExportUpdateScreen(NestedClientPrivatePtr pPriv, int x1, int y1,
+                         int x2, int y2) {
+    NestedExportRing *ring = pPriv->ring;
+
+    x1 = max(x1, ring->viewX);
+    y1 = max(y1, ring->viewY);
+    x2 = min(x2, ring->viewX + (int)ring->viewWidth);
+    y2 = min(y2, ring->viewY + (int)ring->viewHeight);
+
+    if (x1 >= x2 || y1 >= y2) {
+        NESTED_STATS_ADD(pPriv->stats, skipped, 1);
+        return;
+    }
+
+    /* The consumer reads the pixels itself, no bytes are sent */
+    NestedExportPush(pPriv, NESTED_EXPORT_DAMAGE, x1, y1, x2, y2);
+    NESTED_STATS_ADD(pPriv->stats, uploads, 1);
+    NestedStatsUploaded(pPriv->stats);
+}
+
+static void
+NestedExportSetColor(NestedClientPrivatePtr pPriv, int index,
+                     uint16_t red, uint16_t green, uint16_t blue) {
+    pPriv->ring->palette[index] = (red >> 8) << 16 | (green >> 8) << 8 |
+                                  blue >> 8;
+}
+
+static void
+NestedExportUpdatePalette(NestedClientPrivatePtr pPriv) {
+    NestedExportPush(pPriv, NESTED_EXPORT_PALETTE, 0, 0, 0, 0);
+}
+
+static void
+NestedExportSetWorkers(NestedClientPrivatePtr pPriv,
+                       NestedWorkersPtr workers) {
+}
+
+static void
+NestedExportSetStats(NestedClientPrivatePtr pPriv, NestedStatsPtr stats) {
+    pPriv->stats = stats;
+}
+
+/* The consumer may still have the old size mapped */
+static void
+NestedExportReleaseFrameBuffer(NestedClientPrivatePtr pPriv, int height) {
+}
+
+static void
+NestedExportSetViewport(NestedClientPrivatePtr pPriv, int x, int y) {
+    pPriv->ring->viewX = x;
+    pPriv->ring->viewY = y;
+    NestedExportPush(pPriv, NESTED_EXPORT_GEOMETRY, 0, 0, 0, 0);
+}
+
+static void
+NestedExportResizeWindow(NestedClientPrivatePtr pPriv, int width,
+                         int height) {
+    pPriv->ring->viewWidth = width;
+    pPriv->ring->viewHeight = height;
+    NestedExportPush(pPriv, NESTED_EXPORT_GEOMETRY, 0, 0, 0, 0);
+}
+
+/* Consumers can't resize us */
+static void
+NestedExportSetResizeHandler(NestedClientPrivatePtr pPriv,
+                             NestedClientResizeProc proc, void *data) {
+}
+
+static void
+NestedExportHideCursor(NestedClientPrivatePtr pPriv) {
+}
+
+static void
+NestedExportSetParked(NestedClientPrivatePtr pPriv, Bool parked) {
+    if (parked)
+        NestedExportPush(pPriv, NESTED_EXPORT_PARKED, 0, 0, 0, 0);
+}
+
+static void
+NestedExportDropClient(NestedClientPrivatePtr pPriv) {
+    epoll_ctl(pPriv->epollFd, EPOLL_CTL_DEL, pPriv->clientFd, NULL);
+    close(pPriv->clientFd);
+    pPriv->clientFd = -1;
+    pPriv->inputLength = 0;
+
+    xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Export consumer disconnected\n");
+}
+
+/* Hands the shared memory to a new consumer; there is one at a time */
+static void
+NestedExportAccept(NestedClientPrivatePtr pPriv) {
+    NestedExportHello hello = { NESTED_EXPORT_MAGIC, NESTED_EXPORT_VERSION,
+                                pPriv->fbSize, sizeof(NestedExportRing) };
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = { &hello, sizeof(hello) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct epoll_event ev;
+    int fd, fds[2] = { pPriv->fbFd, pPriv->ringFd };
+    struct ucred cred;
+    socklen_t credLen;
+
+    while ((fd = accept4(pPriv->listenFd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (pPriv->clientFd >= 0) {
+            close(fd);
+            continue;
+        }
+
+        /* Only our own user gets the framebuffer and the input */
+        credLen = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) < 0 ||
+            cred.uid != geteuid()) {
+            xf86DrvMsg(pPriv->scrnIndex, X_WARNING,
+                       "Refused export consumer of another user\n");
+            close(fd);
+            continue;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        memset(control, 0, sizeof(control));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(hello) ||
+            epoll_ctl(pPriv->epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+
+        pPriv->clientFd = fd;
+        xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Export consumer connected\n");
+    }
+}
+
+static void
+NestedExportPostInput(NestedClientPrivatePtr pPriv,
+                      const NestedExportInput *input) {
+    if (!pPriv->dev) {
+        NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
+        return;
+    }
+
+    switch (input->type) {
+    case NESTED_EXPORT_MOTION:
+        NestedInputPostMouseMotionEvent(pPriv->dev, input->x, input->y,
+                                        input->time);
+        break;
+    case NESTED_EXPORT_BUTTON:
+        NestedInputPostButtonEvent(pPriv->dev, input->detail, input->down,
+                                   input->time);
+        break;
+    case NESTED_EXPORT_KEY:
+        NestedInputPostKeyboardEvent(pPriv->dev, input->detail, input->down,
+                                     input->time);
+        break;
+    default:
+        NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
+        break;
+    }
+}
+
+static void
+NestedExportCheckEvents(NestedClientPrivatePtr pPriv) {
+    NestedExportInput input;
+    ssize_t len;
+    uint64_t start = NestedStatsNow();
+
+    NestedExportAccept(pPriv);
+
+    while (pPriv->clientFd >= 0) {
+        len = recv(pPriv->clientFd, pPriv->input + pPriv->inputLength,
+                   sizeof(pPriv->input) - pPriv->inputLength, 0);
+
+        if (len < 0 && (errno == EAGAIN || errno == EINTR))
+            break;
+
+        if (len <= 0) {
+            NestedExportDropClient(pPriv);
+            break;
+        }
+
+        pPriv->inputLength += len;
+        if (pPriv->inputLength < sizeof(pPriv->input))
+            continue;
+
+        memcpy(&input, pPriv->input, sizeof(input));
+        pPriv->inputLength = 0;
+        NESTED_STATS_ADD(pPriv->stats, eventsRead, 1);
+        NestedExportPostInput(pPriv, &input);
+    }
+
+    NESTED_STATS_ADD(pPriv->stats, checks, 1);
+    NESTED_STATS_TIME(pPriv->stats, checkTime, start);
+}
+
+static void
+NestedExportProcessDeferred(NestedClientPrivatePtr pPriv) {
+}
+
+static void
+NestedExportCloseScreen(NestedClientPrivatePtr pPriv) {
+    if (pPriv->clientFd >= 0)
+        close(pPriv->clientFd);
+    if (pPriv->listenFd >= 0) {
+        close(pPriv->listenFd);
+        unlink(pPriv->path);
+    }
+    if (pPriv->epollFd >= 0)
+        close(pPriv->epollFd);
+
+    if (pPriv->ring)
+        munmap(pPriv->ring, sizeof(NestedExportRing));
+    if (pPriv->fb)
+        munmap(pPriv->fb, pPriv->fbSize);
+    if (pPriv->ringFd >= 0)
+        close(pPriv->ringFd);
+    if (pPriv->fbFd >= 0)
+        close(pPriv->fbFd);
+
+    free(pPriv);
+}
+
+static void
+NestedExportSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev) {
+    pPriv->dev = dev;
+}
+
+/* Readable when a consumer connects or sends input */
+static int
+NestedExportGetFileDescriptor(NestedClientPrivatePtr pPriv) {
+    return pPriv->epollFd;
+}
+
+/* There is no host keymap to copy: the server's default one is kept, so
+ * consumers send its (evdev) keycodes */
+static Bool
+NestedExportGetKeyboardMappings(NestedClientPrivatePtr pPriv,
+                                KeySymsPtr keySyms, CARD8 *modmap,
+                                XkbControlsPtr ctrls) {
+    return FALSE;
+}
+
+const NestedClientBackendRec nestedExportBackend = {
+    "export",
+    NestedExportCheckDisplay,
+    NestedExportValidDepth,
+    NestedExportProbe,
+    NestedExportCreateScreen,
+    NestedExportStartScreen,
+    NestedExportFinishScreen,
+    NestedExportCreateTile,
+    NestedExportGetFrameBuffer,
+    NestedExportSetAsync,
+    NestedExportUpdateScreen,
+    NestedExportSetColor,
+    NestedExportUpdatePalette,
+    NestedExportSetWorkers,
+    NestedExportSetStats,
+    NestedExportReleaseFrameBuffer,
+    NestedExportSetViewport,
+    NestedExportResizeWindow,
+    NestedExportSetResizeHandler,
+    NestedExportHideCursor,
+    NestedExportSetParked,
+    NestedExportCheckEvents,
+    NestedExportProcessDeferred,
+    NestedExportCloseScreen,
+    NestedExportSetDevicePtr,
+    NestedExportGetFileDescriptor,
+    NestedExportGetKeyboardMappings
+};
@@ -0,0 +1,156 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+
+#include "fbmem.h"
+
+static size_t
+NestedFbHugePageSize(void) {
+    static size_t size;
+    unsigned long kb;
+    char line[128];
+    FILE *f;
+
+    if (size)
+        return size;
+
+    size = 2 * 1024 * 1024;
+
+    f = fopen("/proc/meminfo", "r");
+    if (!f)
+        return size;
+
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+            size = kb * 1024;
+            break;
+        }
+
+    fclose(f);
+    return size;
+}
+
+static size_t
+NestedFbRoundUp(size_t size, size_t pageSize) {
+    return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+void *
+NestedFbMap(size_t size, unsigned int flags, size_t *mappedSize,
+            size_t *pageSize) {
+    void *addr;
+
+#ifdef MAP_HUGETLB
+    /* Needs pages reserved in vm.nr_hugepages */
+    if (flags & NESTED_FB_HUGE_PAGES) {
+        *pageSize = NestedFbHugePageSize();
+        *mappedSize = NestedFbRoundUp(size, *pageSize);
+        addr = mmap(NULL, *mappedSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (addr != MAP_FAILED)
+            return addr;
+    }
+#endif
+
+    /* Only reserve address space: pages get populated as they are drawn
+     * to, so memory use follows the part of the screen in use. */
+    *pageSize = sysconf(_SC_PAGESIZE);
+    *mappedSize = NestedFbRoundUp(size, *pageSize);
+    addr = mmap(NULL, *mappedSize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (addr == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    /* Otherwise let transparent huge pages back it where they can */
+    if ((flags & NESTED_FB_HUGE_PAGES) &&
+        madvise(addr, *mappedSize, MADV_HUGEPAGE) == 0)
+        *pageSize = NestedFbHugePageSize();
+#endif
+
+    return addr;
+}
+
+void
+NestedFbUnmap(void *addr, size_t mappedSize) {
+    if (addr)
+        munmap(addr, mappedSize);
+}
+
+int
+NestedFbShmGet(size_t size, unsigned int flags, size_t *pageSize) {
+    int shmid;
+
+#ifdef SHM_HUGETLB
+    if (flags & NESTED_FB_HUGE_PAGES) {
+        *pageSize = NestedFbHugePageSize();
+        shmid = shmget(IPC_PRIVATE, NestedFbRoundUp(size, *pageSize),
+                       IPC_CREAT | SHM_HUGETLB | 0600);
+
+        if (shmid != -1)
+            return shmid;
+    }
+#endif
+
+    *pageSize = sysconf(_SC_PAGESIZE);
+    return shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+}
+
+void
+NestedFbRelease(void *addr, size_t offset, size_t size, size_t pageSize,
+                int shared) {
+    offset = NestedFbRoundUp(offset, pageSize);
+
+    if (!addr || offset >= size)
+        return;
+
+    /* Dropping a shared mapping would leave the shmem pages allocated */
+#ifdef MADV_REMOVE
+    if (shared)
+        madvise((uint8_t *)addr + offset, size - offset, MADV_REMOVE);
+    else
+#endif
+        madvise((uint8_t *)addr + offset, size - offset, MADV_DONTNEED);
+}
+
+int
+NestedFbLock(void *addr, size_t size, size_t pageSize) {
+    volatile uint8_t *p = addr;
+    size_t i;
+
+    /* Writing, not reading, so no page is left mapped to the zero page */
+    for (i = 0; i < size; i += pageSize)
+        p[i] = 0;
+
+    return mlock(addr, size) == 0;
+}
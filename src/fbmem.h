@@ -0,0 +1,51 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Framebuffer memory: page size selection, prefaulting and locking */
+
+#ifndef NESTED_FBMEM_H
+#define NESTED_FBMEM_H
+
+#include <stddef.h>
+
+#define NESTED_FB_HUGE_PAGES (1 << 0) /* back with huge pages if possible */
+#define NESTED_FB_LOCKED     (1 << 1) /* prefault and mlock */
+
+/* Maps anonymous framebuffer memory, rounded up to the page size in use.
+ * Returns NULL on failure. */
+void *NestedFbMap(size_t size, unsigned int flags, size_t *mappedSize,
+                  size_t *pageSize);
+
+void NestedFbUnmap(void *addr, size_t mappedSize);
+
+/* Like shmget(IPC_PRIVATE, ...), trying SHM_HUGETLB first if asked to.
+ * Only our user can attach the segment: the host checks our credentials. */
+int NestedFbShmGet(size_t size, unsigned int flags, size_t *pageSize);
+
+/* Gives the pages from offset to size back to the system; they read as
+ * zeroes when touched again. shared is set for XShm segments. */
+void NestedFbRelease(void *addr, size_t offset, size_t size,
+                     size_t pageSize, int shared);
+
+/* Touches every page and locks them in memory; returns 0 if mlock failed */
+int NestedFbLock(void *addr, size_t size, size_t pageSize);
+
+#endif /* NESTED_FBMEM_H */
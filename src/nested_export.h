@@ -0,0 +1,106 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Protocol of the export backend, for the processes consuming it.
+ *
+ * A consumer connects to the screen's Unix socket (the Display option,
+ * by default $XDG_RUNTIME_DIR/nested-export-<screen>, or
+ * /tmp/.nested-export-<uid>/nested-export-<screen> without one) as the
+ * server's user, and receives a NestedExportHello carrying two
+ * descriptors (SCM_RIGHTS): the framebuffer, and a NestedExportRing
+ * describing it and listing what changed. Both are meant to be mapped read-only; the server renders
+ * straight into the framebuffer, nothing is copied for the consumer.
+ *
+ * Record n (counting from 0) lives in records[n % numRecords]. The server
+ * sets its index to 0, fills it in, sets index to n + 1 and then head to
+ * n + 1, all stores being releases. A consumer reading index before and
+ * after copying a record knows it got it whole if both are n + 1; a
+ * record it fell too far behind for has a larger index.
+ *
+ * The consumer sends NestedExportInput messages back over the socket. */
+
+#ifndef NESTED_EXPORT_H
+#define NESTED_EXPORT_H
+
+#include <stdint.h>
+
+#define NESTED_EXPORT_MAGIC   0x4e455850 /* "NEXP" */
+#define NESTED_EXPORT_VERSION 2
+#define NESTED_EXPORT_RECORDS 256
+
+/* What a record is about */
+#define NESTED_EXPORT_DAMAGE   (1 << 0) /* x1..y2 changed */
+#define NESTED_EXPORT_PALETTE  (1 << 1) /* palette changed */
+#define NESTED_EXPORT_GEOMETRY (1 << 2) /* the shown area changed */
+#define NESTED_EXPORT_PARKED   (1 << 3) /* blanked until the next damage */
+
+typedef struct {
+    uint64_t index; /* n + 1 once complete, see above */
+    uint64_t sequence; /* frame number, from 1 */
+    uint64_t time; /* CLOCK_MONOTONIC, in nanoseconds */
+    uint32_t flags;
+    int32_t x1, y1, x2, y2; /* framebuffer coordinates */
+} NestedExportRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width; /* of the framebuffer */
+    uint32_t height;
+    uint32_t stride;
+    uint32_t bitsPerPixel;
+    uint32_t depth;
+    uint32_t redMask; /* all 0 for palette indices */
+    uint32_t greenMask;
+    uint32_t blueMask;
+    int32_t viewX; /* part of the framebuffer shown */
+    int32_t viewY;
+    uint32_t viewWidth;
+    uint32_t viewHeight;
+    uint32_t palette[256]; /* 0x00RRGGBB, for depth 8 */
+    uint32_t numRecords;
+    uint32_t pad;
+    uint64_t head; /* records written so far */
+    NestedExportRecord records[NESTED_EXPORT_RECORDS];
+} NestedExportRing;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fbSize; /* of the mappings */
+    uint64_t ringSize;
+} NestedExportHello;
+
+#define NESTED_EXPORT_MOTION 1 /* to x, y */
+#define NESTED_EXPORT_BUTTON 2 /* detail is the button */
+#define NESTED_EXPORT_KEY    3 /* detail is the keycode */
+
+typedef struct {
+    uint32_t type;
+    int32_t x;
+    int32_t y;
+    uint32_t detail;
+    uint32_t down;
+    uint32_t pad;
+    uint64_t time; /* CLOCK_MONOTONIC ns it happened at, 0 if unknown */
+} NestedExportInput;
+
+#endif /* NESTED_EXPORT_H */
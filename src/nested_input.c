@@ -53,6 +53,7 @@
 
 #include "client.h"
 #include "nested_input.h"
+#include "probes.h"
 
 #define SYSCALL(call) while (((call) == -1) && (errno == EINTR))
 
@@ -78,6 +79,7 @@ _nested_input_init_axes(DeviceIntPtr device);
 
 typedef struct _NestedInputDeviceRec {
     NestedClientPrivatePtr clientData;
+    NestedStatsPtr stats; /* the screen's, owned by the driver */
     int   version;
 } NestedInputDeviceRec, *NestedInputDevicePtr;
 
@@ -236,8 +238,13 @@ nested_input_on(OsTimerPtr timer, CARD32 time, pointer arg) {
     if(device->public.on)
     {
         pInfo->fd = NestedClientGetFileDescriptor(pNestedInput->clientData);
-        xf86FlushInput(pInfo->fd);
-        xf86AddEnabledDevice(pInfo);
+
+        /* Screens sharing a host connection are all served by the device
+         * of the first one */
+        if (pInfo->fd >= 0) {
+            xf86FlushInput(pInfo->fd);
+            xf86AddEnabledDevice(pInfo);
+        }
     }
     return 0;
 }
@@ -277,7 +284,8 @@ NestedInputControl(DeviceIntPtr device, int what) {
             if (!device->public.on)
                 break;
             
-            xf86RemoveEnabledDevice(pInfo);
+            if (pInfo->fd >= 0)
+                xf86RemoveEnabledDevice(pInfo);
             
             pInfo->fd = -1;
             device->public.on = FALSE;
@@ -336,7 +344,8 @@ input_option_free_list(InputOption **list)
 
 
 void
-NestedInputLoadDriver(NestedClientPrivatePtr clientData) {
+NestedInputLoadDriver(NestedClientPrivatePtr clientData,
+                      NestedStatsPtr stats) {
     DeviceIntPtr dev;
     InputInfoPtr pInfo;
     NestedInputDevicePtr pNestedInput;
@@ -359,6 +368,7 @@ NestedInputLoadDriver(NestedClientPrivatePtr clientData) {
     pInfo = dev->public.devicePrivate;
     pNestedInput = pInfo->private;
     pNestedInput->clientData = clientData;
+    pNestedInput->stats = stats;
 
     // Set our keymap to be the same as the server's
     NestedInputUpdateKeymap(dev);
@@ -368,17 +378,35 @@ NestedInputLoadDriver(NestedClientPrivatePtr clientData) {
     NestedClientSetDevicePtr(clientData, dev);
 }
     
+static void
+NestedInputPosted(DeviceIntPtr dev, uint64_t time) {
+    InputInfoPtr pInfo = dev->public.devicePrivate;
+    NestedInputDevicePtr pNestedInput = pInfo->private;
+
+    NESTED_STATS_ADD(pNestedInput->stats, eventsPosted, 1);
+    NestedStatsPosted(pNestedInput->stats, time);
+}
+
 void
-NestedInputPostMouseMotionEvent(DeviceIntPtr dev, int x, int y) {
+NestedInputPostMouseMotionEvent(DeviceIntPtr dev, int x, int y,
+                                uint64_t time) {
+    NESTED_PROBE3(input_motion, x, y, time);
     xf86PostMotionEvent(dev, TRUE, 0, 2, x, y);
+    NestedInputPosted(dev, time);
 }
 
 void
-NestedInputPostButtonEvent(DeviceIntPtr dev, int button, int isDown) {
+NestedInputPostButtonEvent(DeviceIntPtr dev, int button, int isDown,
+                           uint64_t time) {
+    NESTED_PROBE3(input_button, button, isDown, time);
     xf86PostButtonEvent(dev, 0, button, isDown, 0, 0);
+    NestedInputPosted(dev, time);
 }
 
 void
-NestedInputPostKeyboardEvent(DeviceIntPtr dev, unsigned int keycode, int isDown) {
+NestedInputPostKeyboardEvent(DeviceIntPtr dev, unsigned int keycode, int isDown,
+                             uint64_t time) {
+    NESTED_PROBE3(input_key, keycode, isDown, time);
     xf86PostKeyboardEvent(dev, keycode, isDown);
+    NestedInputPosted(dev, time);
 }
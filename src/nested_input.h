@@ -32,9 +32,10 @@
 #include <xf86.h>
 #include "xf86Xinput.h"
 
-// Loads the nested input driver.
+// Loads the nested input driver. Input posted is counted in stats.
 void
-NestedInputLoadDriver(NestedClientPrivatePtr clientData);
+NestedInputLoadDriver(NestedClientPrivatePtr clientData,
+                      NestedStatsPtr stats);
 
 // Driver init functions.
 int
@@ -42,10 +43,14 @@ NestedInputPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags);
 void
 NestedInputUnInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags);
 
-// Input event posting functions.
+// Input event posting functions. time is when the host event happened,
+// as NestedStatsNow(), or 0 if unknown.
 void
-NestedInputPostMouseMotionEvent(DeviceIntPtr dev, int x, int y);
+NestedInputPostMouseMotionEvent(DeviceIntPtr dev, int x, int y,
+                                uint64_t time);
 void
-NestedInputPostButtonEvent(DeviceIntPtr dev, int button, int isDown);
+NestedInputPostButtonEvent(DeviceIntPtr dev, int button, int isDown,
+                           uint64_t time);
 void 
-NestedInputPostKeyboardEvent(DeviceIntPtr dev, unsigned int keycode, int isDown);
+NestedInputPostKeyboardEvent(DeviceIntPtr dev, unsigned int keycode, int isDown,
+                             uint64_t time);
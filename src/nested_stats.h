@@ -0,0 +1,128 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Layout of the per-screen statistics page, for the tools reading it.
+ *
+ * Each screen keeps its counters in a file under /dev/shm for as long as
+ * the server runs. They only ever grow, and each is updated atomically on
+ * its own: readers map the page read-only and take the difference between
+ * two samples, there is no lock to take.
+ *
+ * Input latency is followed from the host event to the upload of the
+ * damage it caused, in histograms of microseconds. Host event times are
+ * only known when the host's clock is ours (CLOCK_MONOTONIC, as Xorg and
+ * Xvfb timestamps are), that is for a host on the same machine. */
+
+#ifndef NESTED_STATS_H
+#define NESTED_STATS_H
+
+#include <stdint.h>
+
+#define NESTED_STATS_MAGIC   0x4e535441 /* "NSTA" */
+#define NESTED_STATS_VERSION 2
+#define NESTED_STATS_DIR     "/dev/shm"
+#define NESTED_STATS_PREFIX  "nested-stats." /* followed by pid.screen */
+
+/* Four buckets per power of two, so values are off by less than a
+ * quarter; anything past 16 seconds is counted in the last one */
+#define NESTED_STATS_BUCKETS 96
+
+typedef struct {
+    uint64_t count;
+    uint64_t buckets[NESTED_STATS_BUCKETS];
+} NestedStatsHistogram;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    int32_t scrnIndex;
+    char backend[16];
+    char display[64]; /* the host's, as configured */
+
+    uint64_t updates; /* shadow updates */
+    uint64_t updateTime; /* nanoseconds spent in them */
+    uint64_t damageRects;
+    uint64_t damageArea; /* pixels */
+    uint64_t uploads; /* rectangles sent to the host */
+    uint64_t uploadBytes;
+    uint64_t coalesced; /* damage merged into an upload still to happen */
+    uint64_t skipped; /* damage nobody could see */
+    uint64_t roundTrips; /* waits for the host */
+    uint64_t checks; /* host event checks */
+    uint64_t checkTime; /* nanoseconds spent in them */
+    uint64_t eventsRead;
+    uint64_t eventsPosted; /* as input */
+    uint64_t eventsDropped; /* input that had nowhere to go */
+
+    /* Where the latency of the last input is at, 0 when not waiting */
+    uint64_t inputTime; /* first post not followed by damage yet */
+    uint64_t inputOrigin; /* when its host event happened */
+    uint64_t damageTime; /* first damage caused by input not uploaded yet */
+    uint64_t damageOrigin;
+
+    NestedStatsHistogram eventToPost;
+    NestedStatsHistogram postToDamage;
+    NestedStatsHistogram damageToUpload;
+    NestedStatsHistogram eventToUpload; /* all of the above */
+} NestedStatsPage;
+
+static inline int
+NestedStatsBucket(uint64_t value) {
+    int bits = 63 - __builtin_clzll(value | 1);
+
+    if (bits < 2)
+        return value;
+
+    return bits * 4 + ((value >> (bits - 2)) & 3) - 4;
+}
+
+/* Smallest value falling in a bucket */
+static inline uint64_t
+NestedStatsBucketValue(int bucket) {
+    int bits = bucket / 4 + 1;
+
+    if (bucket < 4)
+        return bucket;
+
+    return (uint64_t)(4 + bucket % 4) << (bits - 2);
+}
+
+/* Returns the value below which the given fraction of the samples are,
+ * from a histogram or the difference of two */
+static inline uint64_t
+NestedStatsPercentile(const NestedStatsHistogram *hist, double fraction) {
+    uint64_t seen = 0, rank = hist->count * fraction;
+    int i;
+
+    if (!hist->count)
+        return 0;
+
+    for (i = 0; i < NESTED_STATS_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen > rank)
+            return NestedStatsBucketValue(i);
+    }
+
+    return NestedStatsBucketValue(NESTED_STATS_BUCKETS - 1);
+}
+
+#endif /* NESTED_STATS_H */
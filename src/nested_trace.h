@@ -0,0 +1,63 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Format of damage traces, for the tools replaying them.
+ *
+ * A trace starts with a NestedTraceHeader. Each shadow update then adds a
+ * NestedTraceFrame followed by its damage rectangles and, if the header
+ * has NESTED_TRACE_PIXELS, the contents of each rectangle in turn: its
+ * rows, packed, in the framebuffer's format. All values are in the
+ * recording machine's byte order. */
+
+#ifndef NESTED_TRACE_H
+#define NESTED_TRACE_H
+
+#include <stdint.h>
+
+#define NESTED_TRACE_MAGIC   0x4e545243 /* "NTRC" */
+#define NESTED_TRACE_VERSION 1
+
+#define NESTED_TRACE_PIXELS (1 << 0) /* rectangle contents are recorded */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t width; /* of the framebuffer */
+    uint32_t height;
+    uint32_t depth;
+    uint32_t bitsPerPixel;
+    uint32_t redMask;
+    uint32_t greenMask;
+    uint32_t blueMask;
+} NestedTraceHeader;
+
+typedef struct {
+    uint64_t time; /* nanoseconds since the trace started */
+    uint32_t numRects;
+    uint32_t pad;
+} NestedTraceFrame;
+
+typedef struct {
+    int16_t x1, y1, x2, y2;
+} NestedTraceRect;
+
+#endif /* NESTED_TRACE_H */
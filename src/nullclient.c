@@ -0,0 +1,506 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* A client backend without a host: the framebuffer lives in memory and
+ * updates are copied into a second image standing in for the host's, so
+ * rendering and the update path can be measured on machines without a
+ * display. Its display name is the rate, in Hz, of the synthetic pointer
+ * motion it generates; no input is generated without one. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "client.h"
+#include "convert.h"
+#include "fbmem.h"
+
+#include "nested_input.h"
+
+/* Pixels the synthetic pointer moves per event */
+#define NESTED_NULL_MOTION_STEP 8
+
+struct NestedClientPrivate {
+    NestedClientBackendPtr backend;
+    int scrnIndex;
+    char *fb;
+    int fbStride;
+    size_t fbMapSize;
+    size_t fbPageSize;
+    unsigned int fbFlags; /* NESTED_FB_* */
+    Bool sharedFb; /* fb belongs to the driver, we show a tile of it */
+    int tileX, tileY;
+    uint8_t *img; /* what would be uploaded to a host */
+    int imgStride;
+    size_t imgMapSize;
+    size_t imgPageSize;
+    int height;
+    NestedConverter conv;
+    BoxRec viewport;
+    Bool parked;
+    NestedClientResizeProc resizeProc;
+    void *resizeData;
+    int motionRate; /* synthetic motion events per second */
+    CARD32 lastMotion;
+    unsigned int motionStep;
+    unsigned long updates;
+    unsigned long long pixels;
+    NestedStatsPtr stats; /* owned by the driver */
+    NestedClientPrivatePtr inputOwner;
+    DeviceIntPtr dev;
+};
+
+struct NestedClientPendingScreen {
+    NestedClientBackendPtr backend;
+    NestedClientPrivatePtr pPriv;
+    uint32_t redMask, greenMask, blueMask;
+};
+
+static Bool
+NestedNullCheckDisplay(char *displayName) {
+    return TRUE;
+}
+
+static Bool
+NestedNullValidDepth(int depth) {
+    return depth == 8 || depth == 16 || depth == 24 || depth == 30;
+}
+
+/* Only ever used when asked for */
+static int
+NestedNullProbe(char *displayName) {
+    return NESTED_TRANSPORT_NONE;
+}
+
+static NestedClientPrivatePtr
+NestedNullCreate(int scrnIndex, char *displayName, int width, int height,
+                 int windowWidth, int windowHeight, int depth,
+                 int bitsPerPixel, int transportDepth, unsigned int fbFlags,
+                 char *fb, int fbStride, int tileX, int tileY,
+                 uint32_t *retRedMask, uint32_t *retGreenMask,
+                 uint32_t *retBlueMask) {
+    NestedClientPrivatePtr pPriv;
+    NestedFormat guestFormat, hostFormat;
+
+    guestFormat = NestedFormatForDepth(depth, bitsPerPixel);
+    if (transportDepth == 16)
+        hostFormat = NESTED_FORMAT_R5G6B5;
+    else if (transportDepth == 24 || guestFormat == NESTED_FORMAT_C8)
+        hostFormat = NESTED_FORMAT_X8R8G8B8;
+    else
+        hostFormat = guestFormat;
+
+    pPriv = calloc(1, sizeof(struct NestedClientPrivate));
+    if (!pPriv)
+        return NULL;
+
+    pPriv->backend = &nestedNullBackend;
+    pPriv->scrnIndex = scrnIndex;
+    pPriv->fbFlags = fbFlags;
+    pPriv->height = height;
+    pPriv->viewport.x2 = windowWidth;
+    pPriv->viewport.y2 = windowHeight;
+    pPriv->motionRate = displayName ? atoi(displayName) : 0;
+    pPriv->tileX = tileX;
+    pPriv->tileY = tileY;
+
+    /* Same-format screens still copy, as they would upload */
+    if (!NestedConvertInit(&pPriv->conv, guestFormat, hostFormat)) {
+        xf86DrvMsg(scrnIndex, X_ERROR,
+                   "Can't convert depth %d/%d bpp to %s\n", depth,
+                   bitsPerPixel, NestedFormatName(hostFormat));
+        free(pPriv);
+        return NULL;
+    }
+
+    if (fb) {
+        pPriv->fb = fb;
+        pPriv->fbStride = fbStride;
+        pPriv->sharedFb = TRUE;
+    } else {
+        pPriv->fbStride = ((width * bitsPerPixel + 31) / 32) * 4;
+        pPriv->fb = NestedFbMap((size_t)pPriv->fbStride * height, fbFlags,
+                                &pPriv->fbMapSize, &pPriv->fbPageSize);
+        if (!pPriv->fb) {
+            free(pPriv);
+            return NULL;
+        }
+
+        if ((fbFlags & NESTED_FB_LOCKED) &&
+            !NestedFbLock(pPriv->fb, pPriv->fbMapSize, pPriv->fbPageSize))
+            xf86DrvMsg(scrnIndex, X_WARNING,
+                       "Failed to lock the framebuffer in memory\n");
+    }
+
+    pPriv->imgStride = ((width * NestedFormatBitsPerPixel(hostFormat) + 31) /
+                        32) * 4;
+    pPriv->img = NestedFbMap((size_t)pPriv->imgStride * height, 0,
+                             &pPriv->imgMapSize, &pPriv->imgPageSize);
+    if (!pPriv->img) {
+        if (!pPriv->sharedFb)
+            NestedFbUnmap(pPriv->fb, pPriv->fbMapSize);
+        free(pPriv);
+        return NULL;
+    }
+
+    NestedFormatGetMasks(guestFormat, retRedMask, retGreenMask, retBlueMask);
+
+    xf86DrvMsg(scrnIndex, X_INFO, "Null screen %dx%d, copying %s to %s "
+               "using %s kernels\n", width, height,
+               NestedFormatName(guestFormat), NestedFormatName(hostFormat),
+               pPriv->conv.isa);
+    return pPriv;
+}
+
+static NestedClientPrivatePtr
+NestedNullCreateScreen(int scrnIndex,
+                       char *displayName,
+                       int width,
+                       int height,
+                       int windowWidth,
+                       int windowHeight,
+                       int originX,
+                       int originY,
+                       int depth,
+                       int bitsPerPixel,
+                       int transportDepth,
+                       unsigned int fbFlags,
+                       uint32_t *retRedMask,
+                       uint32_t *retGreenMask,
+                       uint32_t *retBlueMask) {
+    return NestedNullCreate(scrnIndex, displayName, width, height,
+                            windowWidth, windowHeight, depth, bitsPerPixel,
+                            transportDepth, fbFlags, NULL, 0, 0, 0,
+                            retRedMask, retGreenMask, retBlueMask);
+}
+
+/* Nothing to wait for: the screen is created right away */
+static NestedClientPendingPtr
+NestedNullStartScreen(int scrnIndex,
+                      char *displayName,
+                      int width,
+                      int height,
+                      int windowWidth,
+                      int windowHeight,
+                      int originX,
+                      int originY,
+                      int depth,
+                      int bitsPerPixel,
+                      int transportDepth,
+                      unsigned int fbFlags) {
+    NestedClientPendingPtr pending;
+
+    pending = calloc(1, sizeof(struct NestedClientPendingScreen));
+    if (!pending)
+        return NULL;
+
+    pending->backend = &nestedNullBackend;
+    pending->pPriv = NestedNullCreateScreen(scrnIndex, displayName, width,
+                                            height, windowWidth, windowHeight,
+                                            originX, originY, depth,
+                                            bitsPerPixel, transportDepth,
+                                            fbFlags, &pending->redMask,
+                                            &pending->greenMask,
+                                            &pending->blueMask);
+    return pending;
+}
+
+static NestedClientPrivatePtr
+NestedNullFinishScreen(NestedClientPendingPtr pending,
+                       uint32_t *retRedMask,
+                       uint32_t *retGreenMask,
+                       uint32_t *retBlueMask) {
+    NestedClientPrivatePtr pPriv = pending->pPriv;
+
+    *retRedMask = pending->redMask;
+    *retGreenMask = pending->greenMask;
+    *retBlueMask = pending->blueMask;
+    free(pending);
+
+    return pPriv;
+}
+
+static NestedClientPrivatePtr
+NestedNullCreateTile(int scrnIndex,
+                     char *displayName,
+                     char *fb,
+                     int fbStride,
+                     int x,
+                     int y,
+                     int width,
+                     int height,
+                     int originX,
+                     int originY,
+                     int depth,
+                     int bitsPerPixel,
+                     int transportDepth,
+                     NestedClientPrivatePtr inputOwner) {
+    NestedClientPrivatePtr pPriv;
+    uint32_t redMask, greenMask, blueMask;
+
+    pPriv = NestedNullCreate(scrnIndex, displayName, width, height,
+                             width, height, depth, bitsPerPixel,
+                             transportDepth, 0,
+                             fb + y * fbStride + x * bitsPerPixel / 8,
+                             fbStride, x, y, &redMask, &greenMask, &blueMask);
+
+    if (pPriv)
+        pPriv->inputOwner = inputOwner;
+
+    return pPriv;
+}
+
+static char *
+NestedNullGetFrameBuffer(NestedClientPrivatePtr pPriv) {
+    return pPriv->fb;
+}
+
+/* Copies are cheap enough to stay on the main thread */
+static Bool
+NestedNullSetAsync(NestedClientPrivatePtr pPriv) {
+    return TRUE;
+}
+
+static void
+NestedNullUpdateScreen(NestedClientPrivatePtr pPriv, int x1, int y1,
+                       int x2, int y2) {
+    x1 = max(x1, pPriv->viewport.x1);
+    y1 = max(y1, pPriv->viewport.y1);
+    x2 = min(x2, pPriv->viewport.x2);
+    y2 = min(y2, pPriv->viewport.y2);
+
+    if (x1 >= x2 || y1 >= y2) {
+        NESTED_STATS_ADD(pPriv->stats, skipped, 1);
+        return;
+    }
+
+    NestedConvertRect(&pPriv->conv, (uint8_t *)pPriv->fb, pPriv->fbStride,
+                      pPriv->img, pPriv->imgStride,
+                      x1, y1, x2 - x1, y2 - y1);
+
+    pPriv->updates++;
+    pPriv->pixels += (unsigned long long)(x2 - x1) * (y2 - y1);
+
+    NESTED_STATS_ADD(pPriv->stats, uploads, 1);
+    NESTED_STATS_ADD(pPriv->stats, uploadBytes,
+                     (uint64_t)(x2 - x1) * (y2 - y1) *
+                     NestedFormatBitsPerPixel(pPriv->conv.dst) / 8);
+    NestedStatsUploaded(pPriv->stats);
+}
+
+static void
+NestedNullSetColor(NestedClientPrivatePtr pPriv, int index,
+                   uint16_t red, uint16_t green, uint16_t blue) {
+    if (pPriv->conv.src == NESTED_FORMAT_C8)
+        NestedConvertSetColor(&pPriv->conv, index, red, green, blue);
+}
+
+static void
+NestedNullUpdatePalette(NestedClientPrivatePtr pPriv) {
+    if (pPriv->conv.src == NESTED_FORMAT_C8 && !pPriv->parked)
+        NestedNullUpdateScreen(pPriv, pPriv->viewport.x1, pPriv->viewport.y1,
+                               pPriv->viewport.x2, pPriv->viewport.y2);
+}
+
+static void
+NestedNullSetWorkers(NestedClientPrivatePtr pPriv, NestedWorkersPtr workers) {
+}
+
+static void
+NestedNullSetStats(NestedClientPrivatePtr pPriv, NestedStatsPtr stats) {
+    pPriv->stats = stats;
+}
+
+static void
+NestedNullReleaseFrameBuffer(NestedClientPrivatePtr pPriv, int height) {
+    if (pPriv->fbFlags & NESTED_FB_LOCKED)
+        return;
+
+    NestedFbRelease(pPriv->img, (size_t)pPriv->imgStride * height,
+                    (size_t)pPriv->imgStride * pPriv->height,
+                    pPriv->imgPageSize, FALSE);
+
+    if (!pPriv->sharedFb)
+        NestedFbRelease(pPriv->fb, (size_t)pPriv->fbStride * height,
+                        (size_t)pPriv->fbStride * pPriv->height,
+                        pPriv->fbPageSize, FALSE);
+}
+
+static void
+NestedNullSetViewport(NestedClientPrivatePtr pPriv, int x, int y) {
+    pPriv->viewport.x2 += x - pPriv->viewport.x1;
+    pPriv->viewport.y2 += y - pPriv->viewport.y1;
+    pPriv->viewport.x1 = x;
+    pPriv->viewport.y1 = y;
+}
+
+static void
+NestedNullResizeWindow(NestedClientPrivatePtr pPriv, int width, int height) {
+    pPriv->viewport.x2 = pPriv->viewport.x1 + width;
+    pPriv->viewport.y2 = pPriv->viewport.y1 + height;
+}
+
+static void
+NestedNullSetResizeHandler(NestedClientPrivatePtr pPriv,
+                           NestedClientResizeProc proc, void *data) {
+    pPriv->resizeProc = proc;
+    pPriv->resizeData = data;
+}
+
+static void
+NestedNullHideCursor(NestedClientPrivatePtr pPriv) {
+}
+
+static void
+NestedNullSetParked(NestedClientPrivatePtr pPriv, Bool parked) {
+    pPriv->parked = parked;
+}
+
+/* Walks the pointer around a rectangle in the middle of the window, one
+ * step per period of the configured rate */
+static void
+NestedNullCheckEvents(NestedClientPrivatePtr pPriv) {
+    DeviceIntPtr dev = pPriv->inputOwner ? pPriv->inputOwner->dev :
+                                           pPriv->dev;
+    int w = (pPriv->viewport.x2 - pPriv->viewport.x1) / 2;
+    int h = (pPriv->viewport.y2 - pPriv->viewport.y1) / 2;
+    CARD32 now = GetTimeInMillis();
+    int t, x, y;
+
+    NESTED_STATS_ADD(pPriv->stats, checks, 1);
+
+    if (!dev || pPriv->motionRate <= 0 ||
+        now - pPriv->lastMotion < 1000 / pPriv->motionRate)
+        return;
+
+    pPriv->lastMotion = now;
+    t = (pPriv->motionStep++ * NESTED_NULL_MOTION_STEP) %
+        max(2 * (w + h), 1);
+
+    if (t < w) {
+        x = t;
+        y = 0;
+    } else if (t < w + h) {
+        x = w;
+        y = t - w;
+    } else if (t < 2 * w + h) {
+        x = 2 * w + h - t;
+        y = h;
+    } else {
+        x = 0;
+        y = 2 * (w + h) - t;
+    }
+
+    NestedInputPostMouseMotionEvent(dev,
+                                    pPriv->tileX + pPriv->viewport.x1 +
+                                    w / 2 + x,
+                                    pPriv->tileY + pPriv->viewport.y1 +
+                                    h / 2 + y, NestedStatsNow());
+    NESTED_STATS_ADD(pPriv->stats, eventsRead, 1);
+}
+
+static void
+NestedNullProcessDeferred(NestedClientPrivatePtr pPriv) {
+}
+
+static void
+NestedNullCloseScreen(NestedClientPrivatePtr pPriv) {
+    xf86DrvMsg(pPriv->scrnIndex, X_INFO,
+               "Null screen: %lu updates, %llu pixels copied\n",
+               pPriv->updates, pPriv->pixels);
+
+    NestedFbUnmap(pPriv->img, pPriv->imgMapSize);
+
+    if (!pPriv->sharedFb)
+        NestedFbUnmap(pPriv->fb, pPriv->fbMapSize);
+
+    free(pPriv);
+}
+
+static void
+NestedNullSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev) {
+    pPriv->dev = dev;
+}
+
+/* Events are generated from the block handler, nothing to wake up for */
+static int
+NestedNullGetFileDescriptor(NestedClientPrivatePtr pPriv) {
+    return -1;
+}
+
+/* An empty keymap with the usual autorepeat */
+static Bool
+NestedNullGetKeyboardMappings(NestedClientPrivatePtr pPriv,
+                              KeySymsPtr keySyms, CARD8 *modmap,
+                              XkbControlsPtr ctrls) {
+    keySyms->minKeyCode = 8;
+    keySyms->maxKeyCode = 255;
+    keySyms->mapWidth = 1;
+
+    /* Large enough for the 64 bit layout nested_input.c may read it as */
+    keySyms->map = calloc(keySyms->maxKeyCode - keySyms->minKeyCode + 1,
+                          sizeof(unsigned long));
+    if (!keySyms->map)
+        return FALSE;
+
+    memset(modmap, 0, sizeof(CARD8) * MAP_LENGTH);
+    memset(ctrls, 0, sizeof(XkbControlsRec));
+    ctrls->enabled_ctrls = XkbRepeatKeysMask;
+    ctrls->repeat_delay = 660;
+    ctrls->repeat_interval = 40;
+    return TRUE;
+}
+
+const NestedClientBackendRec nestedNullBackend = {
+    "null",
+    NestedNullCheckDisplay,
+    NestedNullValidDepth,
+    NestedNullProbe,
+    NestedNullCreateScreen,
+    NestedNullStartScreen,
+    NestedNullFinishScreen,
+    NestedNullCreateTile,
+    NestedNullGetFrameBuffer,
+    NestedNullSetAsync,
+    NestedNullUpdateScreen,
+    NestedNullSetColor,
+    NestedNullUpdatePalette,
+    NestedNullSetWorkers,
+    NestedNullSetStats,
+    NestedNullReleaseFrameBuffer,
+    NestedNullSetViewport,
+    NestedNullResizeWindow,
+    NestedNullSetResizeHandler,
+    NestedNullHideCursor,
+    NestedNullSetParked,
+    NestedNullCheckEvents,
+    NestedNullProcessDeferred,
+    NestedNullCloseScreen,
+    NestedNullSetDevicePtr,
+    NestedNullGetFileDescriptor,
+    NestedNullGetKeyboardMappings
+};
@@ -0,0 +1,59 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Static tracepoints (USDT) on the hot paths, for perf and bpftrace:
+ *
+ *   bpftrace -e 'usdt:/path/to/nested_drv.so:nested:damage { ... }'
+ *
+ * They are nops in place when sys/sdt.h is available, and not there at
+ * all otherwise.
+ *
+ *   damage          screen, rects, x1, y1, x2, y2: a shadow update
+ *   upload_start    client, x1, y1, x2, y2
+ *   upload_end      client
+ *   events_start    client: reading host events
+ *   events_end      client
+ *   input_motion    x, y, host event time (ns, 0 if unknown)
+ *   input_button    button, down, time
+ *   input_key       keycode, down, time */
+
+#ifndef NESTED_PROBES_H
+#define NESTED_PROBES_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define NESTED_PROBE1(name, a) \
+    DTRACE_PROBE1(nested, name, a)
+#define NESTED_PROBE3(name, a, b, c) \
+    DTRACE_PROBE3(nested, name, a, b, c)
+#define NESTED_PROBE5(name, a, b, c, d, e) \
+    DTRACE_PROBE5(nested, name, a, b, c, d, e)
+#define NESTED_PROBE6(name, a, b, c, d, e, f) \
+    DTRACE_PROBE6(nested, name, a, b, c, d, e, f)
+#else
+#define NESTED_PROBE1(name, a) do { } while (0)
+#define NESTED_PROBE3(name, a, b, c) do { } while (0)
+#define NESTED_PROBE5(name, a, b, c, d, e) do { } while (0)
+#define NESTED_PROBE6(name, a, b, c, d, e, f) do { } while (0)
+#endif
+
+#endif /* NESTED_PROBES_H */
@@ -0,0 +1,202 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+/* Host timestamps older than this come from another clock */
+#define NESTED_STATS_MAX_AGE 10000 /* ms */
+
+static void
+NestedStatsPath(char *path, size_t size, int pid, int scrnIndex) {
+    snprintf(path, size, NESTED_STATS_DIR "/" NESTED_STATS_PREFIX "%d.%d",
+             pid, scrnIndex);
+}
+
+/* The directory is world-writable and the name easy to guess, so the
+ * page is only ever a new file of ours. A file left by an earlier server
+ * with our pid is replaced, anything else is left alone. */
+static int
+NestedStatsOpen(const char *path) {
+    struct stat st;
+    int fd;
+
+    /* Readable by anyone: the counters tell nothing about the session */
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+              0644);
+    if (fd >= 0 || errno != EEXIST)
+        return fd;
+
+    if (lstat(path, &st) < 0 || !S_ISREG(st.st_mode) ||
+        st.st_uid != geteuid() || unlink(path) < 0)
+        return -1;
+
+    return open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                0644);
+}
+
+NestedStatsPtr
+NestedStatsCreate(int scrnIndex, const char *backend, const char *display) {
+    NestedStatsPtr stats;
+    char path[64];
+    int fd;
+
+    NestedStatsPath(path, sizeof(path), getpid(), scrnIndex);
+
+    fd = NestedStatsOpen(path);
+    if (fd < 0)
+        return NULL;
+
+    if (ftruncate(fd, sizeof(NestedStatsPage)) < 0) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    stats = mmap(NULL, sizeof(NestedStatsPage), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (stats == MAP_FAILED) {
+        unlink(path);
+        return NULL;
+    }
+
+    stats->version = NESTED_STATS_VERSION;
+    stats->pid = getpid();
+    stats->scrnIndex = scrnIndex;
+    snprintf(stats->backend, sizeof(stats->backend), "%s", backend);
+    snprintf(stats->display, sizeof(stats->display), "%s",
+             display ? display : "");
+    __atomic_store_n(&stats->magic, NESTED_STATS_MAGIC, __ATOMIC_RELEASE);
+
+    return stats;
+}
+
+void
+NestedStatsDestroy(NestedStatsPtr stats) {
+    char path[64];
+
+    if (!stats)
+        return;
+
+    NestedStatsPath(path, sizeof(path), stats->pid, stats->scrnIndex);
+    unlink(path);
+    munmap(stats, sizeof(NestedStatsPage));
+}
+
+uint64_t
+NestedStatsNow(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint64_t
+NestedStatsHostTime(uint32_t hostTime) {
+    uint64_t now = NestedStatsNow();
+    /* Both wrap around together */
+    uint32_t age = (uint32_t)(now / 1000000) - hostTime;
+
+    if (age > NESTED_STATS_MAX_AGE)
+        return 0;
+
+    return now - (uint64_t)age * 1000000;
+}
+
+static void
+NestedStatsRecord(NestedStatsHistogram *hist, uint64_t start, uint64_t end) {
+    int bucket = NestedStatsBucket((end - start) / 1000);
+
+    bucket = bucket < NESTED_STATS_BUCKETS ? bucket : NESTED_STATS_BUCKETS - 1;
+    __atomic_fetch_add(&hist->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+}
+
+/* Only the first input since the last damage is followed: later ones
+ * are waiting on the same frame. Posts and damage happen on the main
+ * thread, uploads may not. */
+void
+NestedStatsPosted(NestedStatsPtr stats, uint64_t eventTime) {
+    uint64_t now;
+
+    if (!stats)
+        return;
+
+    now = NestedStatsNow();
+    if (eventTime > now)
+        eventTime = 0;
+
+    if (eventTime)
+        NestedStatsRecord(&stats->eventToPost, eventTime, now);
+
+    if (!stats->inputTime) {
+        stats->inputOrigin = eventTime ? eventTime : now;
+        stats->inputTime = now;
+    }
+}
+
+void
+NestedStatsDamaged(NestedStatsPtr stats) {
+    uint64_t now;
+
+    if (!stats || !stats->inputTime)
+        return;
+
+    now = NestedStatsNow();
+    NestedStatsRecord(&stats->postToDamage, stats->inputTime, now);
+    stats->inputTime = 0;
+
+    /* Damage still waiting for an upload already covers this input */
+    if (!__atomic_load_n(&stats->damageTime, __ATOMIC_ACQUIRE)) {
+        stats->damageOrigin = stats->inputOrigin;
+        __atomic_store_n(&stats->damageTime, now, __ATOMIC_RELEASE);
+    }
+}
+
+void
+NestedStatsUploaded(NestedStatsPtr stats) {
+    uint64_t now, damage;
+
+    if (!stats || !__atomic_load_n(&stats->damageTime, __ATOMIC_RELAXED))
+        return;
+
+    damage = __atomic_exchange_n(&stats->damageTime, 0, __ATOMIC_ACQUIRE);
+    if (!damage)
+        return;
+
+    now = NestedStatsNow();
+    NestedStatsRecord(&stats->damageToUpload, damage, now);
+    NestedStatsRecord(&stats->eventToUpload, stats->damageOrigin, now);
+}
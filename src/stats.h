@@ -0,0 +1,62 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Per-screen counters of what the driver does, see nested_stats.h */
+
+#ifndef NESTED_STATS_DRIVER_H
+#define NESTED_STATS_DRIVER_H
+
+#include "nested_stats.h"
+
+typedef NestedStatsPage *NestedStatsPtr;
+
+/* Returns NULL if the page can't be created; counting into a NULL page
+ * does nothing. */
+NestedStatsPtr NestedStatsCreate(int scrnIndex, const char *backend,
+                                 const char *display);
+
+void NestedStatsDestroy(NestedStatsPtr stats);
+
+/* CLOCK_MONOTONIC, in nanoseconds */
+uint64_t NestedStatsNow(void);
+
+/* Turns a host event timestamp (in milliseconds) into a NestedStatsNow()
+ * time; 0 if the host's clock can't be ours */
+uint64_t NestedStatsHostTime(uint32_t hostTime);
+
+/* Follows the latency of input, see nested_stats.h: an event that
+ * happened at eventTime (0 if unknown) was posted, the screen was damaged,
+ * damage was uploaded. */
+void NestedStatsPosted(NestedStatsPtr stats, uint64_t eventTime);
+void NestedStatsDamaged(NestedStatsPtr stats);
+void NestedStatsUploaded(NestedStatsPtr stats);
+
+#define NESTED_STATS_ADD(stats, counter, n)                              \
+    do {                                                                 \
+        if (stats)                                                       \
+            __atomic_fetch_add(&(stats)->counter, (n), __ATOMIC_RELAXED);\
+    } while (0)
+
+/* Adds the time since start, a NestedStatsNow() value */
+#define NESTED_STATS_TIME(stats, counter, start)                         \
+    NESTED_STATS_ADD(stats, counter, NestedStatsNow() - (start))
+
+#endif /* NESTED_STATS_DRIVER_H */
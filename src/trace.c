@@ -0,0 +1,137 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "stats.h"
+#include "trace.h"
+
+/* Large writes: a trace with pixels can grow by megabytes per frame */
+#define NESTED_TRACE_BUFFER (1024 * 1024)
+
+struct NestedTrace {
+    FILE *file;
+    char *buffer;
+    Bool pixels;
+    int bytesPerPixel;
+    uint64_t start;
+    Bool failed;
+};
+
+NestedTracePtr
+NestedTraceOpen(const char *path, Bool pixels, int width, int height,
+                int depth, int bitsPerPixel, uint32_t redMask,
+                uint32_t greenMask, uint32_t blueMask) {
+    NestedTraceHeader header = {
+        NESTED_TRACE_MAGIC, NESTED_TRACE_VERSION,
+        pixels ? NESTED_TRACE_PIXELS : 0,
+        width, height, depth, bitsPerPixel, redMask, greenMask, blueMask
+    };
+    NestedTracePtr trace;
+
+    trace = calloc(1, sizeof(struct NestedTrace));
+    if (!trace)
+        return NULL;
+
+    trace->file = fopen(path, "wbe");
+    trace->buffer = malloc(NESTED_TRACE_BUFFER);
+    if (!trace->file || !trace->buffer) {
+        NestedTraceClose(trace);
+        return NULL;
+    }
+
+    setvbuf(trace->file, trace->buffer, _IOFBF, NESTED_TRACE_BUFFER);
+    trace->pixels = pixels;
+    trace->bytesPerPixel = bitsPerPixel / 8;
+    trace->start = NestedStatsNow();
+
+    if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+        NestedTraceClose(trace);
+        return NULL;
+    }
+
+    return trace;
+}
+
+static Bool
+NestedTraceWrite(NestedTracePtr trace, const void *data, size_t size) {
+    if (!trace->failed && size && fwrite(data, size, 1, trace->file) != 1)
+        trace->failed = TRUE;
+
+    return !trace->failed;
+}
+
+Bool
+NestedTraceFrameAdd(NestedTracePtr trace, const BoxRec *boxes, int numBoxes,
+                    const uint8_t *fb, int fbStride) {
+    NestedTraceFrame frame = { NestedStatsNow() - trace->start, numBoxes, 0 };
+    NestedTraceRect rect;
+    size_t rowBytes;
+    int i, y;
+
+    if (!NestedTraceWrite(trace, &frame, sizeof(frame)))
+        return FALSE;
+
+    for (i = 0; i < numBoxes; i++) {
+        rect.x1 = boxes[i].x1;
+        rect.y1 = boxes[i].y1;
+        rect.x2 = boxes[i].x2;
+        rect.y2 = boxes[i].y2;
+
+        if (!NestedTraceWrite(trace, &rect, sizeof(rect)))
+            return FALSE;
+    }
+
+    if (!trace->pixels)
+        return TRUE;
+
+    for (i = 0; i < numBoxes; i++) {
+        rowBytes = (size_t)(boxes[i].x2 - boxes[i].x1) * trace->bytesPerPixel;
+
+        for (y = boxes[i].y1; y < boxes[i].y2; y++)
+            if (!NestedTraceWrite(trace, fb + (size_t)y * fbStride +
+                                  boxes[i].x1 * trace->bytesPerPixel,
+                                  rowBytes))
+                return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+NestedTraceClose(NestedTracePtr trace) {
+    if (!trace)
+        return;
+
+    if (trace->file)
+        fclose(trace->file);
+
+    free(trace->buffer);
+    free(trace);
+}
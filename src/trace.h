@@ -0,0 +1,46 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Records the damage the shadow layer reports, see nested_trace.h */
+
+#ifndef NESTED_TRACE_DRIVER_H
+#define NESTED_TRACE_DRIVER_H
+
+#include <stdint.h>
+
+#include "nested_trace.h"
+
+typedef struct NestedTrace *NestedTracePtr;
+
+/* Returns NULL if the file can't be written */
+NestedTracePtr NestedTraceOpen(const char *path, Bool pixels, int width,
+                               int height, int depth, int bitsPerPixel,
+                               uint32_t redMask, uint32_t greenMask,
+                               uint32_t blueMask);
+
+/* Adds a frame with the given damage, taking the pixels from fb if asked
+ * to; returns FALSE once writing failed, the trace is then useless */
+Bool NestedTraceFrameAdd(NestedTracePtr trace, const BoxRec *boxes,
+                         int numBoxes, const uint8_t *fb, int fbStride);
+
+void NestedTraceClose(NestedTracePtr trace);
+
+#endif /* NESTED_TRACE_DRIVER_H */
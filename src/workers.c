@@ -0,0 +1,180 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "workers.h"
+
+struct NestedWorkers {
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_t *threads;
+    int numThreads;
+
+    /* The current job; generation changes every time one is posted */
+    NestedWorkProc proc;
+    void *data;
+    int count;
+    int next;
+    int finished;
+    unsigned int generation;
+    int quit;
+};
+
+/* Takes stripes until there are none left. Called with the lock held. */
+static void
+NestedWorkersDrain(NestedWorkersPtr workers) {
+    while (workers->next < workers->count) {
+        int index = workers->next++;
+
+        pthread_mutex_unlock(&workers->lock);
+        workers->proc(workers->data, index, workers->count);
+        pthread_mutex_lock(&workers->lock);
+
+        if (++workers->finished == workers->count)
+            pthread_cond_signal(&workers->done);
+    }
+}
+
+static void *
+NestedWorkersThread(void *arg) {
+    NestedWorkersPtr workers = arg;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&workers->lock);
+
+    for (;;) {
+        while (!workers->quit && workers->generation == seen)
+            pthread_cond_wait(&workers->start, &workers->lock);
+
+        if (workers->quit)
+            break;
+
+        seen = workers->generation;
+        NestedWorkersDrain(workers);
+    }
+
+    pthread_mutex_unlock(&workers->lock);
+    return NULL;
+}
+
+NestedWorkersPtr
+NestedWorkersCreate(int threads) {
+    NestedWorkersPtr workers;
+    sigset_t all, saved;
+
+    if (threads < 1)
+        return NULL;
+
+    workers = calloc(1, sizeof(struct NestedWorkers));
+    if (!workers)
+        return NULL;
+
+    workers->threads = calloc(threads, sizeof(pthread_t));
+    if (!workers->threads) {
+        free(workers);
+        return NULL;
+    }
+
+    pthread_mutex_init(&workers->lock, NULL);
+    pthread_cond_init(&workers->start, NULL);
+    pthread_cond_init(&workers->done, NULL);
+
+    /* Signals (SIGIO input, timers) must keep going to the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+
+    while (workers->numThreads < threads &&
+           pthread_create(&workers->threads[workers->numThreads], NULL,
+                          NestedWorkersThread, workers) == 0)
+        workers->numThreads++;
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (!workers->numThreads) {
+        NestedWorkersDestroy(workers);
+        return NULL;
+    }
+
+    return workers;
+}
+
+void
+NestedWorkersDestroy(NestedWorkersPtr workers) {
+    int i;
+
+    if (!workers)
+        return;
+
+    pthread_mutex_lock(&workers->lock);
+    workers->quit = 1;
+    pthread_cond_broadcast(&workers->start);
+    pthread_mutex_unlock(&workers->lock);
+
+    for (i = 0; i < workers->numThreads; i++)
+        pthread_join(workers->threads[i], NULL);
+
+    pthread_cond_destroy(&workers->done);
+    pthread_cond_destroy(&workers->start);
+    pthread_mutex_destroy(&workers->lock);
+    free(workers->threads);
+    free(workers);
+}
+
+int
+NestedWorkersCount(NestedWorkersPtr workers) {
+    return workers ? workers->numThreads + 1 : 1;
+}
+
+void
+NestedWorkersRun(NestedWorkersPtr workers, NestedWorkProc proc,
+                 void *data, int count) {
+    int i;
+
+    if (!workers || count < 2) {
+        for (i = 0; i < count; i++)
+            proc(data, i, count);
+        return;
+    }
+
+    pthread_mutex_lock(&workers->lock);
+    workers->proc = proc;
+    workers->data = data;
+    workers->count = count;
+    workers->next = 0;
+    workers->finished = 0;
+    workers->generation++;
+    pthread_cond_broadcast(&workers->start);
+
+    NestedWorkersDrain(workers);
+
+    while (workers->finished < workers->count)
+        pthread_cond_wait(&workers->done, &workers->lock);
+
+    pthread_mutex_unlock(&workers->lock);
+}
@@ -0,0 +1,46 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* A small pool of threads that runs the stripes of a large update in
+ * parallel; the calling thread takes its share of the stripes too. */
+
+#ifndef NESTED_WORKERS_H
+#define NESTED_WORKERS_H
+
+struct NestedWorkers;
+typedef struct NestedWorkers *NestedWorkersPtr;
+
+/* Processes stripe index out of count */
+typedef void (*NestedWorkProc)(void *data, int index, int count);
+
+/* Returns NULL if no thread could be started */
+NestedWorkersPtr NestedWorkersCreate(int threads);
+
+void NestedWorkersDestroy(NestedWorkersPtr workers);
+
+/* Number of stripes that can run at once, the calling thread included */
+int NestedWorkersCount(NestedWorkersPtr workers);
+
+/* Runs all stripes and returns when they are done */
+void NestedWorkersRun(NestedWorkersPtr workers, NestedWorkProc proc,
+                      void *data, int count);
+
+#endif /* NESTED_WORKERS_H */
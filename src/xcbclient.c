@@ -33,6 +33,10 @@
  *   Laércio de Sousa <laerciosousa@sme-mogidascruzes.sp.gov.br>
  */
 
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <sys/ipc.h>
@@ -55,48 +59,435 @@
 #endif
 
 #include "client.h"
+#include "convert.h"
+#include "fbmem.h"
+#include "workers.h"
 
 #include "nested_input.h"
 
+/* Smallest stripe worth handing to another thread */
+#define NESTED_STRIPE_MIN_PIXELS (128 * 1024)
+
+/* Smallest size the host window can be resized to */
+#define NESTED_WINDOW_MIN_WIDTH  320
+#define NESTED_WINDOW_MIN_HEIGHT 200
+
+/* A connection to a host display, shared by all screens shown on it */
+typedef struct NestedClientHost {
+    struct NestedClientHost *next;
+    char *displayName; /* as requested; NULL for $DISPLAY */
+    Bool connecting; /* listed, but not usable yet */
+    Display *display;
+    xcb_connection_t *connection;
+    int refCount; /* screens using it */
+    int numScreens;
+    NestedClientPrivatePtr *screens; /* looked up by window for events */
+    xcb_atom_t netWmState;
+    xcb_atom_t netWmStateHidden;
+    xcb_cursor_t emptyCursor; /* XCB_NONE until a window needs it */
+    Bool haveKeymap; /* until the host's mapping changes */
+    KeySymsRec keySyms;
+    CARD8 modmap[MAP_LENGTH];
+    XkbControlsRec ctrls;
+} NestedClientHost, *NestedClientHostPtr;
+
+static NestedClientHostPtr nestedHosts;
+static pthread_mutex_t nestedHostsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t nestedHostsCond = PTHREAD_COND_INITIALIZER;
+
+/* Messages logged while a screen is brought up in the background are
+ * kept and logged by the server thread once it collects the screen. */
+typedef struct NestedClientLogEntry {
+    struct NestedClientLogEntry *next;
+    int scrnIndex;
+    MessageType type;
+    char *text;
+} NestedClientLogEntry;
+
+static __thread NestedClientLogEntry **nestedLogTail;
+
+struct NestedClientPendingScreen {
+    NestedClientBackendPtr backend;
+    pthread_t thread;
+    Bool threaded;
+    NestedClientLogEntry *log;
+    CARD32 startTime;
+    CARD32 endTime;
+    NestedClientPrivatePtr pPriv;
+
+    /* Arguments of NestedXcbCreateScreen */
+    int scrnIndex;
+    char *displayName;
+    int width, height;
+    int windowWidth, windowHeight;
+    int originX, originY;
+    int depth, bitsPerPixel;
+    int transportDepth;
+    unsigned int fbFlags;
+    uint32_t redMask, greenMask, blueMask;
+};
+
+/* When the first background bring-up started, for the total startup time */
+static CARD32 nestedStartTime;
+static int nestedPendingScreens;
+
+static void NestedXcbHideCursor(NestedClientPrivatePtr pPriv);
+
 struct NestedClientPrivate {
+    NestedClientBackendPtr backend;
+    NestedClientHostPtr host;
     Display *display;
     xcb_connection_t *connection;
     int screenNumber;
-    xcb_visualtype_t *visual;
+    xcb_visualtype_t *visual; /* of the window, not necessarily the root's */
+    uint8_t depth;
+    uint32_t blackPixel;
     xcb_screen_t *screen;
     xcb_window_t rootWindow;
     xcb_window_t window;
-    xcb_image_t *img;
+    xcb_pixmap_t backing; /* host-side copy of the last presented frame */
+    xcb_image_t *img; /* in the host's format */
+    char *fb; /* the nested framebuffer; img->data unless converting */
+    int fbStride;
+    unsigned int fbFlags; /* NESTED_FB_* */
+    size_t fbPageSize;
+    size_t fbMapSize; /* of fb, when converting */
+    size_t imgPageSize;
+    size_t imgMapSize; /* of the image data, without XShm */
+    Bool converting;
+    Bool sharedFb; /* fb belongs to the driver, we show a tile of it */
+    int tileX, tileY; /* where that tile is in the framebuffer */
+    NestedClientPrivatePtr inputOwner; /* screen posting input for a tile */
+    NestedConverter conv;
+    NestedWorkersPtr workers; /* owned by the driver */
+    NestedStatsPtr stats; /* likewise */
     xcb_gcontext_t gc;
+    uint8_t *scratch; /* row packing buffer for uploads without XShm */
     Bool usingShm;
     xcb_shm_segment_info_t shminfo;
     int scrnIndex; /* stored only for xf86DrvMsg usage */
+    BoxRec viewport; /* part of the framebuffer shown in the window */
+    NestedClientResizeProc resizeProc;
+    void *resizeData;
+    xcb_atom_t netWmState;
+    xcb_atom_t netWmStateHidden;
+    Bool mapped;
+    Bool obscured;
+    Bool hidden;
+    Bool parked; /* screen is blanked, the window just shows black */
+    Bool hasPending;
+    BoxRec pending; /* damage accumulated while the window can't be seen */
+    /* Set by the event handler, acted on from the block handler */
+    volatile Bool visibilityChanged;
+    volatile Bool wmStateChanged;
+    volatile Bool configured;
+    int configuredWidth, configuredHeight; /* size from ConfigureNotify */
+    Bool async; /* uploads happen on a thread of their own */
+    pthread_t uploader;
+    pthread_mutex_t queueLock;
+    pthread_cond_t queueCond;
+    Bool queued;
+    BoxRec queue; /* damage waiting for the uploader, under queueLock */
+    Bool quit;
+    pthread_mutex_t uploadLock; /* held while converting and uploading */
     DeviceIntPtr dev; // The pointer to the input device.  Passed back to the
                       // input driver when posting input events.
 };
 
-/* Checks if a display is open */
-Bool
-NestedClientCheckDisplay(char *displayName) {
-    xcb_connection_t *c;
+static void
+NestedClientMsg(int scrnIndex, MessageType type, const char *format, ...)
+    _X_ATTRIBUTE_PRINTF(3, 4);
+
+static void
+NestedClientMsg(int scrnIndex, MessageType type, const char *format, ...) {
+    NestedClientLogEntry *entry;
+    va_list args;
+    int len;
+
+    if (!nestedLogTail) {
+        va_start(args, format);
+        xf86VDrvMsgVerb(scrnIndex, type, 1, format, args);
+        va_end(args);
+        return;
+    }
+
+    va_start(args, format);
+    len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    entry = malloc(sizeof(NestedClientLogEntry));
+    if (!entry)
+        return;
+
+    entry->text = malloc(len + 1);
+    if (!entry->text) {
+        free(entry);
+        return;
+    }
+
+    va_start(args, format);
+    vsnprintf(entry->text, len + 1, format, args);
+    va_end(args);
+
+    entry->next = NULL;
+    entry->scrnIndex = scrnIndex;
+    entry->type = type;
+    *nestedLogTail = entry;
+    nestedLogTail = &entry->next;
+}
+
+static xcb_atom_t
+NestedClientInternAtom(xcb_connection_t *c, const char *name) {
+    xcb_intern_atom_cookie_t atom_c;
+    xcb_intern_atom_reply_t *atom_r;
+    xcb_atom_t atom = XCB_ATOM_NONE;
+
+    atom_c = xcb_intern_atom(c, FALSE, strlen(name), name);
+    atom_r = xcb_intern_atom_reply(c, atom_c, NULL);
+
+    if (atom_r) {
+        atom = atom_r->atom;
+        free(atom_r);
+    }
+
+    return atom;
+}
+
+static Bool
+NestedClientSameDisplay(const char *a, const char *b) {
+    if (!a || !b)
+        return a == b;
+
+    return strcmp(a, b) == 0;
+}
 
-    c = xcb_connect(displayName, NULL);
-    
-    if (xcb_connection_has_error(c)) {
+static Bool
+NestedClientConnectHost(NestedClientHostPtr host) {
+    /* XXX: Get rid of the Display as soon as we can
+     * port all XKB related calls to XCB. */
+    host->display = XOpenDisplay(host->displayName);
+    if (!host->display)
+        return FALSE;
+
+    host->connection = XGetXCBConnection(host->display);
+    XSetEventQueueOwner(host->display, XCBOwnsEventQueue);
+
+    if (xcb_connection_has_error(host->connection)) {
+        XCloseDisplay(host->display);
         return FALSE;
     }
-    else {
-        xcb_disconnect(c);
-        return TRUE;
+
+    host->netWmState = NestedClientInternAtom(host->connection,
+                                              "_NET_WM_STATE");
+    host->netWmStateHidden = NestedClientInternAtom(host->connection,
+                                                    "_NET_WM_STATE_HIDDEN");
+    return TRUE;
+}
+
+/* Returns the connection to a display, opening it if there is none yet.
+ * Called with nestedHostsLock held, which is dropped while connecting:
+ * other hosts are connected to meanwhile, screens on the same host wait
+ * for this connection. */
+static NestedClientHostPtr
+NestedClientLookupHost(const char *displayName) {
+    NestedClientHostPtr host, *prev;
+    Bool connected;
+
+    while (TRUE) {
+        for (host = nestedHosts; host; host = host->next)
+            if (NestedClientSameDisplay(host->displayName, displayName))
+                break;
+
+        if (!host || !host->connecting)
+            break;
+
+        pthread_cond_wait(&nestedHostsCond, &nestedHostsLock);
+    }
+
+    if (host)
+        return host;
+
+    host = calloc(1, sizeof(NestedClientHost));
+    if (!host)
+        return NULL;
+
+    host->displayName = displayName ? strdup(displayName) : NULL;
+    if (displayName && !host->displayName) {
+        free(host);
+        return NULL;
+    }
+
+    host->connecting = TRUE;
+    host->next = nestedHosts;
+    nestedHosts = host;
+
+    pthread_mutex_unlock(&nestedHostsLock);
+    connected = NestedClientConnectHost(host);
+    pthread_mutex_lock(&nestedHostsLock);
+
+    host->connecting = FALSE;
+    pthread_cond_broadcast(&nestedHostsCond);
+
+    if (connected)
+        return host;
+
+    /* Whoever waited looks again, and tries connecting itself */
+    for (prev = &nestedHosts; *prev; prev = &(*prev)->next)
+        if (*prev == host) {
+            *prev = host->next;
+            break;
+        }
+
+    free(host->displayName);
+    free(host);
+    return NULL;
+}
+
+/* Takes a reference on the connection to a display */
+static NestedClientHostPtr
+NestedClientGetHost(const char *displayName) {
+    NestedClientHostPtr host;
+
+    pthread_mutex_lock(&nestedHostsLock);
+    host = NestedClientLookupHost(displayName);
+    if (host)
+        host->refCount++;
+    pthread_mutex_unlock(&nestedHostsLock);
+
+    return host;
+}
+
+static void
+NestedClientPutHost(NestedClientHostPtr host) {
+    NestedClientHostPtr *prev;
+
+    pthread_mutex_lock(&nestedHostsLock);
+
+    if (--host->refCount > 0) {
+        pthread_mutex_unlock(&nestedHostsLock);
+        return;
+    }
+
+    for (prev = &nestedHosts; *prev; prev = &(*prev)->next)
+        if (*prev == host) {
+            *prev = host->next;
+            break;
+        }
+
+    pthread_mutex_unlock(&nestedHostsLock);
+
+    XCloseDisplay(host->display);
+    free(host->keySyms.map);
+    free(host->screens);
+    free(host->displayName);
+    free(host);
+}
+
+static Bool
+NestedClientAddToHost(NestedClientHostPtr host, NestedClientPrivatePtr pPriv) {
+    NestedClientPrivatePtr *screens;
+
+    pthread_mutex_lock(&nestedHostsLock);
+
+    screens = realloc(host->screens,
+                      (host->numScreens + 1) * sizeof(*screens));
+    if (screens) {
+        screens[host->numScreens++] = pPriv;
+        host->screens = screens;
     }
+
+    pthread_mutex_unlock(&nestedHostsLock);
+    return screens != NULL;
 }
 
-Bool
-NestedClientValidDepth(int depth) {
-    /* XXX: implement! */
+static void
+NestedClientRemoveFromHost(NestedClientHostPtr host,
+                           NestedClientPrivatePtr pPriv) {
+    int i;
+
+    pthread_mutex_lock(&nestedHostsLock);
+
+    for (i = 0; i < host->numScreens; i++)
+        if (host->screens[i] == pPriv) {
+            host->screens[i] = host->screens[--host->numScreens];
+            break;
+        }
+
+    pthread_mutex_unlock(&nestedHostsLock);
+}
+
+/* Only checks the display name: the connection is opened by the screen's
+ * bring-up thread, so several hosts are connected to at once */
+static Bool
+NestedXcbCheckDisplay(char *displayName) {
+    char *hostName;
+    int display, screen;
+
+    if (!xcb_parse_display(displayName, &hostName, &display, &screen))
+        return FALSE;
+
+    free(hostName);
     return TRUE;
 }
 
+/* Checks that the host can attach our shared memory segments, which
+ * remote hosts advertising MIT-SHM can't. The probe holds its own reference
+ * on the connection, so it is closed again unless a screen uses it. */
+static Bool
+NestedClientProbeShm(xcb_connection_t *connection) {
+    const xcb_query_extension_reply_t *shm_rep;
+    xcb_generic_error_t *e;
+    xcb_shm_seg_t shmseg;
+    size_t pageSize;
+    int shmid;
+    Bool attached = FALSE;
+
+    shm_rep = xcb_get_extension_data(connection, &xcb_shm_id);
+    if (!shm_rep || !shm_rep->present)
+        return FALSE;
+
+    shmid = NestedFbShmGet(4096, 0, &pageSize);
+    if (shmid == -1)
+        return FALSE;
+
+    shmseg = xcb_generate_id(connection);
+    e = xcb_request_check(connection,
+                          xcb_shm_attach_checked(connection, shmseg,
+                                                 shmid, TRUE));
+    if (e) {
+        free(e);
+    } else {
+        xcb_shm_detach(connection, shmseg);
+        xcb_flush(connection);
+        attached = TRUE;
+    }
+
+    shmctl(shmid, IPC_RMID, NULL);
+    return attached;
+}
+
+static int
+NestedXcbProbe(char *displayName) {
+    NestedClientHostPtr host;
+    int transport;
+
+    host = NestedClientGetHost(displayName);
+    if (!host)
+        return NESTED_TRANSPORT_NONE;
+
+    transport = NestedClientProbeShm(host->connection) ?
+                NESTED_TRANSPORT_SHM : NESTED_TRANSPORT_COPY;
+
+    NestedClientPutHost(host);
+    return transport;
+}
+
+/* Depths we have a framebuffer format for, see NestedFormatForDepth */
+static Bool
+NestedXcbValidDepth(int depth) {
+    return depth == 8 || depth == 16 || depth == 24 || depth == 30;
+}
+
 static Bool
 NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int height, int depth) {
     const xcb_query_extension_reply_t *shm_rep;
@@ -107,7 +498,7 @@ NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int
     shm_rep = xcb_get_extension_data(pPriv->connection, &xcb_shm_id);
 
     if (!shm_rep || !shm_rep->present) {
-        xf86DrvMsg(scrnIndex, X_INFO, "XShm extension query failed. Dropping XShm support.\n");
+        NestedClientMsg(scrnIndex, X_INFO, "XShm extension query failed. Dropping XShm support.\n");
         return FALSE;
     }
 
@@ -116,12 +507,12 @@ NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int
                                                 shm_version_c, &e);
 
     if (e) {
-        xf86DrvMsg(scrnIndex, X_INFO, "XShm extension version query failed. Dropping XShm support.\n");
+        NestedClientMsg(scrnIndex, X_INFO, "XShm extension version query failed. Dropping XShm support.\n");
         free(e);
         return FALSE;
     }
     else {
-        xf86DrvMsg(scrnIndex, X_INFO,
+        NestedClientMsg(scrnIndex, X_INFO,
                    "XShm extension version %d.%d %s shared pixmaps\n",
                    shm_version_r->major_version,
                    shm_version_r->minor_version,
@@ -140,17 +531,17 @@ NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int
                                          NULL);
 
     if (!pPriv->img) {
-        xf86DrvMsg(scrnIndex, X_ERROR, "xcb_image_create_native failed. Dropping XShm support.\n");
+        NestedClientMsg(scrnIndex, X_ERROR, "xcb_image_create_native failed. Dropping XShm support.\n");
         return FALSE;
     }
 
-    /* XXX: change the 0777 mask? */
-    pPriv->shminfo.shmid = shmget(IPC_PRIVATE,
-                                  pPriv->img->stride * pPriv->img->height,
-                                  IPC_CREAT | 0777);
+    pPriv->shminfo.shmid = NestedFbShmGet(pPriv->img->stride *
+                                          pPriv->img->height,
+                                          pPriv->fbFlags,
+                                          &pPriv->imgPageSize);
 
     if (pPriv->shminfo.shmid == -1) {
-        xf86DrvMsg(scrnIndex, X_ERROR, "shmget failed.  Dropping XShm support.\n");
+        NestedClientMsg(scrnIndex, X_ERROR, "shmget failed.  Dropping XShm support.\n");
         xcb_image_destroy(pPriv->img);
         return FALSE;
     }
@@ -159,7 +550,8 @@ NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int
     pPriv->shminfo.shmaddr = pPriv->img->data;
 
     if (pPriv->shminfo.shmaddr == (uint8_t *) -1) {
-        xf86DrvMsg(scrnIndex, X_ERROR, "shmaddr failed.  Dropping XShm support.\n");
+        NestedClientMsg(scrnIndex, X_ERROR, "shmaddr failed.  Dropping XShm support.\n");
+        shmctl(pPriv->shminfo.shmid, IPC_RMID, NULL);
         xcb_image_destroy(pPriv->img);
         return FALSE;
     }
@@ -174,89 +566,325 @@ NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int
     return TRUE;
 }
 
-NestedClientPrivatePtr
-NestedClientCreateScreen(int scrnIndex,
+static void
+NestedClientFillBlack(NestedClientPrivatePtr pPriv, xcb_drawable_t drawable,
+                      int16_t x, int16_t y, uint16_t width, uint16_t height) {
+    xcb_rectangle_t rect = {x, y, width, height};
+    uint32_t black = pPriv->blackPixel;
+
+    xcb_change_gc(pPriv->connection, pPriv->gc, XCB_GC_FOREGROUND, &black);
+    xcb_poly_fill_rectangle(pPriv->connection, drawable,
+                            pPriv->gc, 1, &rect);
+}
+
+/* Exposes are repaired from this pixmap with a host-local copy, so they
+ * never cause framebuffer pixels to be sent again. */
+static void
+NestedClientCreateBacking(NestedClientPrivatePtr pPriv) {
+    int width = pPriv->viewport.x2 - pPriv->viewport.x1;
+    int height = pPriv->viewport.y2 - pPriv->viewport.y1;
+
+    pPriv->backing = xcb_generate_id(pPriv->connection);
+    xcb_create_pixmap(pPriv->connection,
+                      pPriv->depth,
+                      pPriv->backing,
+                      pPriv->window,
+                      width, height);
+
+    NestedClientFillBlack(pPriv, pPriv->backing, 0, 0, width, height);
+}
+
+static xcb_visualtype_t *
+NestedClientFindVisual(xcb_screen_t *screen, int depth) {
+    xcb_depth_iterator_t depth_i;
+    xcb_visualtype_iterator_t visual_i;
+
+    for (depth_i = xcb_screen_allowed_depths_iterator(screen);
+         depth_i.rem;
+         xcb_depth_next(&depth_i)) {
+        if (depth_i.data->depth != depth)
+            continue;
+
+        for (visual_i = xcb_depth_visuals_iterator(depth_i.data);
+             visual_i.rem;
+             xcb_visualtype_next(&visual_i))
+            if (visual_i.data->_class == XCB_VISUAL_CLASS_TRUE_COLOR)
+                return visual_i.data;
+    }
+
+    return NULL;
+}
+
+/* Chooses the nested framebuffer format. When it matches the host visual,
+ * the framebuffer is the host image itself; otherwise damaged areas are
+ * converted into the host image before each upload. */
+static Bool
+NestedClientSetupFormat(NestedClientPrivatePtr pPriv, int width, int height,
+                        int depth, int bitsPerPixel, char *fb, int fbStride,
+                        uint32_t *retRedMask, uint32_t *retGreenMask,
+                        uint32_t *retBlueMask) {
+    NestedFormat guestFormat, hostFormat;
+
+    guestFormat = NestedFormatForDepth(depth, bitsPerPixel);
+    hostFormat = NestedFormatFromMasks(pPriv->img->bpp,
+                                       pPriv->visual->red_mask,
+                                       pPriv->visual->green_mask,
+                                       pPriv->visual->blue_mask);
+
+    if (fb) {
+        /* Tiles always copy out of the shared framebuffer */
+        if (!NestedConvertInit(&pPriv->conv, guestFormat, hostFormat)) {
+            NestedClientMsg(pPriv->scrnIndex, X_ERROR,
+                            "Can't copy depth %d/%d bpp to the host visual "
+                            "(depth %d, %d bpp)\n", depth, bitsPerPixel,
+                            pPriv->img->depth, pPriv->img->bpp);
+            return FALSE;
+        }
+
+        pPriv->converting = TRUE;
+        pPriv->sharedFb = TRUE;
+        pPriv->fb = fb;
+        pPriv->fbStride = fbStride;
+        pPriv->fbPageSize = pPriv->imgPageSize;
+        NestedFormatGetMasks(guestFormat, retRedMask, retGreenMask,
+                             retBlueMask);
+        return TRUE;
+    }
+
+    if (guestFormat == hostFormat ||
+        (hostFormat == NESTED_FORMAT_UNKNOWN &&
+         guestFormat != NESTED_FORMAT_C8 &&
+         depth == pPriv->img->depth && bitsPerPixel == pPriv->img->bpp)) {
+        pPriv->converting = FALSE;
+        pPriv->fb = (char *)pPriv->img->data;
+        pPriv->fbStride = pPriv->img->stride;
+        pPriv->fbPageSize = pPriv->imgPageSize;
+
+        *retRedMask = pPriv->visual->red_mask;
+        *retGreenMask = pPriv->visual->green_mask;
+        *retBlueMask = pPriv->visual->blue_mask;
+        return TRUE;
+    }
+
+    if (!NestedConvertInit(&pPriv->conv, guestFormat, hostFormat)) {
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR,
+                   "Can't convert depth %d/%d bpp to the host visual "
+                   "(depth %d, %d bpp)\n", depth, bitsPerPixel,
+                   pPriv->img->depth, pPriv->img->bpp);
+        return FALSE;
+    }
+
+    pPriv->fbStride = ((width * bitsPerPixel + 31) / 32) * 4;
+    pPriv->fb = NestedFbMap(pPriv->fbStride * height, pPriv->fbFlags,
+                            &pPriv->fbMapSize, &pPriv->fbPageSize);
+
+    if (!pPriv->fb)
+        return FALSE;
+
+    pPriv->converting = TRUE;
+    NestedFormatGetMasks(guestFormat, retRedMask, retGreenMask, retBlueMask);
+
+    NestedClientMsg(pPriv->scrnIndex, X_INFO,
+               "Converting %s to the host's %s using %s kernels\n",
+               NestedFormatName(guestFormat), NestedFormatName(hostFormat),
+               pPriv->conv.isa);
+    return TRUE;
+}
+
+/* Frees what NestedClientCreateWindow got done before failing, including
+ * the window and the reference on the host connection */
+static void
+NestedClientDestroyWindow(NestedClientPrivatePtr pPriv) {
+    if (pPriv->img) {
+        if (pPriv->usingShm) {
+            xcb_shm_detach(pPriv->connection, pPriv->shminfo.shmseg);
+            shmdt(pPriv->shminfo.shmaddr);
+            shmctl(pPriv->shminfo.shmid, IPC_RMID, NULL);
+        } else if (pPriv->img->data) {
+            NestedFbUnmap(pPriv->img->data, pPriv->imgMapSize);
+        }
+
+        xcb_image_destroy(pPriv->img);
+    }
+
+    if (pPriv->converting && !pPriv->sharedFb)
+        NestedFbUnmap(pPriv->fb, pPriv->fbMapSize);
+
+    if (pPriv->backing)
+        xcb_free_pixmap(pPriv->connection, pPriv->backing);
+
+    xcb_destroy_window(pPriv->connection, pPriv->window);
+    xcb_free_gc(pPriv->connection, pPriv->gc);
+    xcb_flush(pPriv->connection);
+
+    NestedClientPutHost(pPriv->host);
+    free(pPriv);
+}
+
+/* Creates the host window of a screen, or of a tile of it when fb is the
+ * shared framebuffer, already offset to the tile */
+static NestedClientPrivatePtr
+NestedClientCreateWindow(int scrnIndex,
                          char *displayName,
                          int width,
                          int height,
+                         int windowWidth,
+                         int windowHeight,
                          int originX,
                          int originY,
                          int depth,
                          int bitsPerPixel,
+                         int transportDepth,
+                         unsigned int fbFlags,
+                         char *fb,
+                         int fbStride,
+                         int tileX,
+                         int tileY,
                          uint32_t *retRedMask,
                          uint32_t *retGreenMask,
                          uint32_t *retBlueMask) {
     NestedClientPrivatePtr pPriv;
     const xcb_query_extension_reply_t *xkb_rep;
     xcb_size_hints_t sizeHints;
+    xcb_colormap_t colormap;
     char windowTitle[32];
-    uint32_t attr;
+    uint32_t attr[3];
 
-    attr = XCB_EVENT_MASK_EXPOSURE
+    attr[0] = 0; /* border pixel */
+    attr[1] = XCB_EVENT_MASK_EXPOSURE
            | XCB_EVENT_MASK_POINTER_MOTION
            | XCB_EVENT_MASK_ENTER_WINDOW
            | XCB_EVENT_MASK_LEAVE_WINDOW
            | XCB_EVENT_MASK_BUTTON_PRESS
            | XCB_EVENT_MASK_BUTTON_RELEASE
            | XCB_EVENT_MASK_KEY_PRESS
-           | XCB_EVENT_MASK_KEY_RELEASE;
+           | XCB_EVENT_MASK_KEY_RELEASE
+           | XCB_EVENT_MASK_VISIBILITY_CHANGE
+           | XCB_EVENT_MASK_STRUCTURE_NOTIFY
+           | XCB_EVENT_MASK_PROPERTY_CHANGE;
 
-    pPriv = malloc(sizeof(struct NestedClientPrivate));
+    pPriv = calloc(1, sizeof(struct NestedClientPrivate));
+    if (!pPriv)
+        return NULL;
+
+    pPriv->backend = &nestedXcbBackend;
     pPriv->scrnIndex = scrnIndex;
-    
-    /* XXX: Get rid of pPriv->display as soon as we can
-     * port all XKB related calls to XCB. */
-    pPriv->display = XOpenDisplay(displayName);
-    pPriv->screenNumber = DefaultScreen(pPriv->display);
-    pPriv->connection = XGetXCBConnection(pPriv->display);
-    XSetEventQueueOwner(pPriv->display, XCBOwnsEventQueue);
+    pPriv->host = NestedClientGetHost(displayName);
 
-    if (xcb_connection_has_error(pPriv->connection))
+    if (!pPriv->host) {
+        NestedClientMsg(scrnIndex, X_ERROR, "Can't open display: %s\n",
+                        displayName ? displayName : "(default)");
+        free(pPriv);
         return NULL;
+    }
+
+    pPriv->display = pPriv->host->display;
+    pPriv->screenNumber = DefaultScreen(pPriv->display);
+    pPriv->connection = pPriv->host->connection;
 
     xkb_rep = xcb_get_extension_data(pPriv->connection, &xcb_xkb_id);
 
     if (!xkb_rep || !xkb_rep->present) {
-        xf86DrvMsg(pPriv->scrnIndex, X_ERROR, "Host X server does not support the XKEYBOARD extension.\n");
-        XCloseDisplay(pPriv->display);
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR, "Host X server does not support the XKEYBOARD extension.\n");
+        NestedClientPutHost(pPriv->host);
+        free(pPriv);
         return NULL;
     }
 
+    pPriv->netWmState = pPriv->host->netWmState;
+    pPriv->netWmStateHidden = pPriv->host->netWmStateHidden;
+    pPriv->mapped = FALSE;
+    pPriv->obscured = FALSE;
+    pPriv->hidden = FALSE;
+    pPriv->parked = FALSE;
+    pPriv->hasPending = FALSE;
+    pPriv->async = FALSE;
+    pPriv->workers = NULL;
+    pPriv->stats = NULL;
+    pPriv->fbFlags = fbFlags;
+    pPriv->scratch = NULL;
+    pPriv->viewport.x1 = 0;
+    pPriv->viewport.y1 = 0;
+    pPriv->viewport.x2 = windowWidth;
+    pPriv->viewport.y2 = windowHeight;
+    pPriv->resizeProc = NULL;
+    pPriv->resizeData = NULL;
+    pPriv->sharedFb = FALSE;
+    pPriv->tileX = tileX;
+    pPriv->tileY = tileY;
+    pPriv->inputOwner = NULL;
+
     pPriv->screen = xcb_aux_get_screen(pPriv->connection, pPriv->screenNumber);
     pPriv->visual = xcb_aux_find_visual_by_id(pPriv->screen,
                                               pPriv->screen->root_visual);
+    pPriv->depth = pPriv->screen->root_depth;
+    pPriv->blackPixel = pPriv->screen->black_pixel;
     pPriv->rootWindow = pPriv->screen->root;
-    pPriv->gc = xcb_generate_id(pPriv->connection);
-    xcb_create_gc(pPriv->connection,
-                  pPriv->gc,
-                  pPriv->rootWindow,
-                  0, NULL);
+    colormap = pPriv->screen->default_colormap;
+
+    /* A shallower window visual means fewer bytes per pixel on the wire;
+     * the framebuffer is converted to it on upload. */
+    if (transportDepth && transportDepth != pPriv->depth) {
+        xcb_visualtype_t *visual = NestedClientFindVisual(pPriv->screen,
+                                                          transportDepth);
+
+        if (visual) {
+            NestedClientMsg(scrnIndex, X_INFO,
+                       "Using a depth %d host visual for transport\n",
+                       transportDepth);
+            pPriv->visual = visual;
+            pPriv->depth = transportDepth;
+            pPriv->blackPixel = 0;
+            colormap = xcb_generate_id(pPriv->connection);
+            xcb_create_colormap(pPriv->connection, XCB_COLORMAP_ALLOC_NONE,
+                                colormap, pPriv->rootWindow,
+                                visual->visual_id);
+        } else {
+            NestedClientMsg(scrnIndex, X_WARNING,
+                       "Host has no TrueColor visual of depth %d, "
+                       "transporting at depth %d\n",
+                       transportDepth, pPriv->depth);
+        }
+    }
+
+    attr[2] = colormap;
 
     pPriv->window = xcb_generate_id(pPriv->connection);
     xcb_create_window(pPriv->connection,
-                      XCB_COPY_FROM_PARENT,
+                      pPriv->depth,
                       pPriv->window,
                       pPriv->rootWindow,
                       0, 0, 100, 100, /* Will move/resize */
                       0,
-                      XCB_WINDOW_CLASS_COPY_FROM_PARENT,
-                      XCB_COPY_FROM_PARENT,
-                      XCB_CW_EVENT_MASK,
-                      &attr);
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                      pPriv->visual->visual_id,
+                      XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK | XCB_CW_COLORMAP,
+                      attr);
+
+    pPriv->gc = xcb_generate_id(pPriv->connection);
+    xcb_create_gc(pPriv->connection,
+                  pPriv->gc,
+                  pPriv->window,
+                  0, NULL);
 
+    /* The window may be resized up to the size of the framebuffer */
     sizeHints.flags = XCB_ICCCM_SIZE_HINT_P_POSITION
                       | XCB_ICCCM_SIZE_HINT_P_SIZE
                       | XCB_ICCCM_SIZE_HINT_P_MIN_SIZE
                       | XCB_ICCCM_SIZE_HINT_P_MAX_SIZE;
-    sizeHints.min_width = width;
+    sizeHints.min_width = min(NESTED_WINDOW_MIN_WIDTH, width);
+    sizeHints.min_height = min(NESTED_WINDOW_MIN_HEIGHT, height);
     sizeHints.max_width = width;
-    sizeHints.min_height = height;
     sizeHints.max_height = height;
     xcb_icccm_set_wm_normal_hints(pPriv->connection,
                                   pPriv->window,
                                   &sizeHints);
 
-    snprintf(windowTitle, sizeof(windowTitle), "Screen %d", scrnIndex);
+    if (fb)
+        snprintf(windowTitle, sizeof(windowTitle), "Screen %d (%d,%d)",
+                 scrnIndex, tileX, tileY);
+    else
+        snprintf(windowTitle, sizeof(windowTitle), "Screen %d", scrnIndex);
     xcb_icccm_set_wm_name(pPriv->connection,
                           pPriv->window,
                           XCB_ATOM_STRING,
@@ -266,7 +894,7 @@ NestedClientCreateScreen(int scrnIndex,
 
     {
         uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
-        uint32_t values[2] = {width, height};
+        uint32_t values[2] = {windowWidth, windowHeight};
         xcb_configure_window(pPriv->connection, pPriv->window, mask, values);
     }
 
@@ -278,51 +906,263 @@ NestedClientCreateScreen(int scrnIndex,
         xcb_configure_window(pPriv->connection, pPriv->window, mask, values);
     }
 
-    if (!NestedClientTryXShm(pPriv, scrnIndex, width, height, depth)) {
+    /* The host image always matches the host window; the nested
+     * framebuffer may use a different format. */
+    if (!NestedClientTryXShm(pPriv, scrnIndex, width, height,
+                             pPriv->depth)) {
         pPriv->img = xcb_image_create_native(pPriv->connection,
                                 width,
                                 height,
                                 XCB_IMAGE_FORMAT_Z_PIXMAP,
-                                depth,
+                                pPriv->depth,
                                 NULL,
                                 ~0,
                                 NULL);
 
-        if (!pPriv->img)
+        if (!pPriv->img) {
+            NestedClientDestroyWindow(pPriv);
             return NULL;
+        }
 
-        pPriv->img->data = malloc(pPriv->img->stride * pPriv->img->height);
+        pPriv->img->data = NestedFbMap(pPriv->img->stride * pPriv->img->height,
+                                       fbFlags, &pPriv->imgMapSize,
+                                       &pPriv->imgPageSize);
         pPriv->usingShm = FALSE;
     }
 
-    if (!pPriv->img->data)
+    if (!pPriv->img->data) {
+        NestedClientDestroyWindow(pPriv);
         return NULL;
+    }
+
+    if (!NestedClientSetupFormat(pPriv, width, height, depth, bitsPerPixel,
+                                 fb, fbStride,
+                                 retRedMask, retGreenMask, retBlueMask)) {
+        NestedClientDestroyWindow(pPriv);
+        return NULL;
+    }
+
+    NestedClientMsg(scrnIndex, X_INFO, "Framebuffer uses %lu KiB pages\n",
+               (unsigned long)pPriv->fbPageSize / 1024);
 
-    NestedClientHideCursor(pPriv); /* Hide cursor */
+    /* Don't let the first frames stall on page faults */
+    if (fbFlags & NESTED_FB_LOCKED) {
+        Bool locked = NestedFbLock(pPriv->img->data,
+                                   pPriv->img->stride * pPriv->img->height,
+                                   pPriv->imgPageSize);
+
+        if (pPriv->converting && !pPriv->sharedFb)
+            locked = NestedFbLock(pPriv->fb, pPriv->fbStride * height,
+                                  pPriv->fbPageSize) && locked;
+
+        if (!locked)
+            NestedClientMsg(scrnIndex, X_WARNING,
+                       "Failed to lock the framebuffer in memory\n");
+    }
+
+    NestedClientCreateBacking(pPriv);
+
+    NestedXcbHideCursor(pPriv); /* Hide cursor */
 
 #if 1
-xf86DrvMsg(scrnIndex, X_INFO, "width: %d\n", pPriv->img->width);
-xf86DrvMsg(scrnIndex, X_INFO, "height: %d\n", pPriv->img->height);
-xf86DrvMsg(scrnIndex, X_INFO, "depth: %d\n", pPriv->img->depth);
-xf86DrvMsg(scrnIndex, X_INFO, "bpp: %d\n", pPriv->img->bpp);
-xf86DrvMsg(scrnIndex, X_INFO, "red_mask: 0x%x\n", pPriv->visual->red_mask);
-xf86DrvMsg(scrnIndex, X_INFO, "gre_mask: 0x%x\n", pPriv->visual->green_mask);
-xf86DrvMsg(scrnIndex, X_INFO, "blu_mask: 0x%x\n", pPriv->visual->blue_mask);
+NestedClientMsg(scrnIndex, X_INFO, "width: %d\n", pPriv->img->width);
+NestedClientMsg(scrnIndex, X_INFO, "height: %d\n", pPriv->img->height);
+NestedClientMsg(scrnIndex, X_INFO, "depth: %d\n", pPriv->img->depth);
+NestedClientMsg(scrnIndex, X_INFO, "bpp: %d\n", pPriv->img->bpp);
+NestedClientMsg(scrnIndex, X_INFO, "red_mask: 0x%x\n", pPriv->visual->red_mask);
+NestedClientMsg(scrnIndex, X_INFO, "gre_mask: 0x%x\n", pPriv->visual->green_mask);
+NestedClientMsg(scrnIndex, X_INFO, "blu_mask: 0x%x\n", pPriv->visual->blue_mask);
 #endif
 
-    *retRedMask = pPriv->visual->red_mask;
-    *retGreenMask = pPriv->visual->green_mask;
-    *retBlueMask = pPriv->visual->blue_mask;
-
     pPriv->dev = (DeviceIntPtr)NULL;
 
+    if (!NestedClientAddToHost(pPriv->host, pPriv)) {
+        NestedClientDestroyWindow(pPriv);
+        return NULL;
+    }
+
+    return pPriv;
+}
+
+static NestedClientPrivatePtr
+NestedXcbCreateScreen(int scrnIndex,
+                      char *displayName,
+                      int width,
+                      int height,
+                      int windowWidth,
+                      int windowHeight,
+                      int originX,
+                      int originY,
+                      int depth,
+                      int bitsPerPixel,
+                      int transportDepth,
+                      unsigned int fbFlags,
+                      uint32_t *retRedMask,
+                      uint32_t *retGreenMask,
+                      uint32_t *retBlueMask) {
+    return NestedClientCreateWindow(scrnIndex, displayName, width, height,
+                                    windowWidth, windowHeight,
+                                    originX, originY, depth, bitsPerPixel,
+                                    transportDepth, fbFlags, NULL, 0, 0, 0,
+                                    retRedMask, retGreenMask, retBlueMask);
+}
+
+static NestedClientPrivatePtr
+NestedXcbCreateTile(int scrnIndex,
+                    char *displayName,
+                    char *fb,
+                    int fbStride,
+                    int x,
+                    int y,
+                    int width,
+                    int height,
+                    int originX,
+                    int originY,
+                    int depth,
+                    int bitsPerPixel,
+                    int transportDepth,
+                    NestedClientPrivatePtr inputOwner) {
+    NestedClientPrivatePtr pPriv;
+    uint32_t redMask, greenMask, blueMask;
+
+    pPriv = NestedClientCreateWindow(scrnIndex, displayName, width, height,
+                                     width, height, originX, originY,
+                                     depth, bitsPerPixel, transportDepth, 0,
+                                     fb + y * fbStride + x * bitsPerPixel / 8,
+                                     fbStride, x, y,
+                                     &redMask, &greenMask, &blueMask);
+
+    if (pPriv)
+        pPriv->inputOwner = inputOwner;
+
     return pPriv;
 }
 
-void NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
-    xcb_cursor_t emptyCursor;
+static void *
+NestedClientBringUp(void *data) {
+    NestedClientPendingPtr pending = data;
+
+    nestedLogTail = &pending->log;
+    pending->pPriv = NestedXcbCreateScreen(pending->scrnIndex,
+                                           pending->displayName,
+                                           pending->width,
+                                           pending->height,
+                                           pending->windowWidth,
+                                           pending->windowHeight,
+                                           pending->originX,
+                                           pending->originY,
+                                           pending->depth,
+                                           pending->bitsPerPixel,
+                                           pending->transportDepth,
+                                           pending->fbFlags,
+                                           &pending->redMask,
+                                           &pending->greenMask,
+                                           &pending->blueMask);
+    nestedLogTail = NULL;
+    pending->endTime = GetTimeInMillis();
+
+    return NULL;
+}
+
+static NestedClientPendingPtr
+NestedXcbStartScreen(int scrnIndex,
+                     char *displayName,
+                     int width,
+                     int height,
+                     int windowWidth,
+                     int windowHeight,
+                     int originX,
+                     int originY,
+                     int depth,
+                     int bitsPerPixel,
+                     int transportDepth,
+                     unsigned int fbFlags) {
+    NestedClientPendingPtr pending;
+    sigset_t all, saved;
+
+    pending = calloc(1, sizeof(struct NestedClientPendingScreen));
+    if (!pending)
+        return NULL;
+
+    pending->backend = &nestedXcbBackend;
+    pending->scrnIndex = scrnIndex;
+    pending->displayName = displayName;
+    pending->width = width;
+    pending->height = height;
+    pending->windowWidth = windowWidth;
+    pending->windowHeight = windowHeight;
+    pending->originX = originX;
+    pending->originY = originY;
+    pending->depth = depth;
+    pending->bitsPerPixel = bitsPerPixel;
+    pending->transportDepth = transportDepth;
+    pending->fbFlags = fbFlags;
+    pending->startTime = GetTimeInMillis();
+
+    if (!nestedPendingScreens++)
+        nestedStartTime = pending->startTime;
+
+    /* Signals must keep going to the server thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    pending->threaded = pthread_create(&pending->thread, NULL,
+                                       NestedClientBringUp, pending) == 0;
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (!pending->threaded)
+        NestedClientBringUp(pending);
+
+    return pending;
+}
+
+static NestedClientPrivatePtr
+NestedXcbFinishScreen(NestedClientPendingPtr pending,
+                      uint32_t *retRedMask,
+                      uint32_t *retGreenMask,
+                      uint32_t *retBlueMask) {
+    NestedClientPrivatePtr pPriv;
+    NestedClientLogEntry *entry, *next;
+
+    if (pending->threaded)
+        pthread_join(pending->thread, NULL);
+
+    for (entry = pending->log; entry; entry = next) {
+        next = entry->next;
+        xf86DrvMsg(entry->scrnIndex, entry->type, "%s", entry->text);
+        free(entry->text);
+        free(entry);
+    }
+
+    NestedClientMsg(pending->scrnIndex, X_INFO,
+                    "Host screen set up in %u ms, %u ms after the first "
+                    "one started\n",
+                    (unsigned int)(pending->endTime - pending->startTime),
+                    (unsigned int)(pending->endTime - nestedStartTime));
+
+    nestedPendingScreens--;
+
+    pPriv = pending->pPriv;
+    *retRedMask = pending->redMask;
+    *retGreenMask = pending->greenMask;
+    *retBlueMask = pending->blueMask;
+    free(pending);
+
+    return pPriv;
+}
+
+static void
+NestedXcbHideCursor(NestedClientPrivatePtr pPriv) {
+    xcb_cursor_t emptyCursor = pPriv->host->emptyCursor;
     xcb_pixmap_t emptyPixmap;
 
+    if (emptyCursor != XCB_NONE) {
+        xcb_change_window_attributes(pPriv->connection,
+                                     pPriv->window,
+                                     XCB_CW_CURSOR,
+                                     &emptyCursor);
+        return;
+    }
+
     emptyPixmap = xcb_generate_id(pPriv->connection);
     xcb_create_pixmap(pPriv->connection,
                       1,
@@ -337,6 +1177,7 @@ void NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
                       0, 0, 0,
                       0, 0, 0,
                       1, 1);
+    pPriv->host->emptyCursor = emptyCursor;
 
     xcb_change_window_attributes(pPriv->connection,
                                  pPriv->window,
@@ -346,129 +1187,790 @@ void NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
     xcb_free_pixmap(pPriv->connection, emptyPixmap);
 }
 
-char *
-NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv) {
-    return pPriv->img->data;
+/* While parked the window is painted black once and nothing else is sent
+ * to the host; the driver repaints the whole screen when unparking. */
+static void
+NestedXcbSetParked(NestedClientPrivatePtr pPriv, Bool parked) {
+    if (pPriv->parked == parked)
+        return;
+
+    pPriv->parked = parked;
+
+    if (parked) {
+        /* A queued frame must not land on top of the black */
+        if (pPriv->async) {
+            pthread_mutex_lock(&pPriv->queueLock);
+            pPriv->queued = FALSE;
+            pthread_mutex_unlock(&pPriv->queueLock);
+            pthread_mutex_lock(&pPriv->uploadLock);
+        }
+
+        NestedClientFillBlack(pPriv, pPriv->window, 0, 0,
+                              pPriv->viewport.x2 - pPriv->viewport.x1,
+                              pPriv->viewport.y2 - pPriv->viewport.y1);
+        xcb_flush(pPriv->connection);
+
+        if (pPriv->async)
+            pthread_mutex_unlock(&pPriv->uploadLock);
+    }
+}
+
+static char *
+NestedXcbGetFrameBuffer(NestedClientPrivatePtr pPriv) {
+    return pPriv->fb;
 }
 
-void
-NestedClientUpdateScreen(NestedClientPrivatePtr pPriv, int16_t x1,
-                         int16_t y1, int16_t x2, int16_t y2) {
+static void
+NestedXcbSetWorkers(NestedClientPrivatePtr pPriv,
+                    NestedWorkersPtr workers) {
+    /* The pool is run from the main thread only */
+    if (!pPriv->async)
+        pPriv->workers = workers;
+}
+
+static void
+NestedXcbSetStats(NestedClientPrivatePtr pPriv, NestedStatsPtr stats) {
+    pPriv->stats = stats;
+}
+
+typedef struct {
+    NestedClientPrivatePtr pPriv;
+    int x, y, width, height;
+} NestedClientStripes;
+
+static void
+NestedClientConvertStripe(void *data, int index, int count) {
+    NestedClientStripes *stripes = data;
+    NestedClientPrivatePtr pPriv = stripes->pPriv;
+    int y1 = stripes->y + stripes->height * index / count;
+    int y2 = stripes->y + stripes->height * (index + 1) / count;
+
+    NestedConvertRect(&pPriv->conv,
+                      (uint8_t *)pPriv->fb, pPriv->fbStride,
+                      pPriv->img->data, pPriv->img->stride,
+                      stripes->x, y1, stripes->width, y2 - y1);
+}
+
+/* Converts a framebuffer rectangle into the host image, splitting it in
+ * row stripes over the worker threads when it is large enough to pay off */
+static void
+NestedClientConvert(NestedClientPrivatePtr pPriv, int x, int y,
+                    int width, int height) {
+    NestedClientStripes stripes = { pPriv, x, y, width, height };
+    int count = NestedWorkersCount(pPriv->workers);
+
+    count = min(count, width * height / NESTED_STRIPE_MIN_PIXELS);
+    count = min(count, height);
+
+    if (count < 2) {
+        NestedConvertRect(&pPriv->conv,
+                          (uint8_t *)pPriv->fb, pPriv->fbStride,
+                          pPriv->img->data, pPriv->img->stride,
+                          x, y, width, height);
+        return;
+    }
+
+    NestedWorkersRun(pPriv->workers, NestedClientConvertStripe, &stripes,
+                     count);
+}
+
+/* Uploads a framebuffer rectangle into the backing pixmap, which only
+ * holds the viewport */
+static void
+NestedClientPutImage(NestedClientPrivatePtr pPriv, int16_t x, int16_t y,
+                     uint16_t width, uint16_t height) {
+    int16_t dstX = x - pPriv->viewport.x1;
+    int16_t dstY = y - pPriv->viewport.y1;
+    uint32_t maxBytes, rowBytes, maxRows, rows, i;
+    uint8_t *src, *dst;
+
     if (pPriv->usingShm) {
-        xcb_image_shm_put(pPriv->connection, pPriv->window,
+        xcb_image_shm_put(pPriv->connection, pPriv->backing,
                           pPriv->gc, pPriv->img,
                           pPriv->shminfo,
-                          x1, y1, x1, y1, x2 - x1, y2 - y1, FALSE);
-    } else {
-        xcb_image_put(pPriv->connection, pPriv->window, pPriv->gc, pPriv->img,
-                      x1, y1, 0);
+                          x, y, dstX, dstY, width, height, FALSE);
+        return;
     }
 
+    /* Without XShm, pack the rows of the rectangle into a scratch buffer
+     * and send it in chunks that fit the maximum request length. */
+    maxBytes = xcb_get_maximum_request_length(pPriv->connection) * 4 -
+               sizeof(xcb_put_image_request_t);
+    rowBytes = ((width * pPriv->img->bpp + pPriv->img->scanline_pad - 1) /
+                pPriv->img->scanline_pad) * pPriv->img->scanline_pad / 8;
+    maxRows = maxBytes / rowBytes;
+    if (maxRows == 0)
+        maxRows = 1;
+
+    if (!pPriv->scratch) {
+        pPriv->scratch = malloc(max(maxBytes, pPriv->img->stride));
+        if (!pPriv->scratch)
+            return;
+    }
+
+    while (height > 0) {
+        rows = height < maxRows ? height : maxRows;
+        src = pPriv->img->data + y * pPriv->img->stride +
+              x * pPriv->img->bpp / 8;
+        dst = pPriv->scratch;
+
+        for (i = 0; i < rows; i++) {
+            memcpy(dst, src, width * pPriv->img->bpp / 8);
+            src += pPriv->img->stride;
+            dst += rowBytes;
+        }
+
+        xcb_put_image(pPriv->connection, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                      pPriv->backing, pPriv->gc,
+                      width, rows, dstX, dstY,
+                      0, pPriv->img->depth,
+                      rows * rowBytes, pPriv->scratch);
+
+        y += rows;
+        dstY += rows;
+        height -= rows;
+    }
+}
+
+static Bool
+NestedClientIsVisible(NestedClientPrivatePtr pPriv) {
+    return pPriv->mapped && !pPriv->obscured && !pPriv->hidden;
+}
+
+static void
+NestedClientUpload(NestedClientPrivatePtr pPriv, int x1, int y1,
+                   int x2, int y2) {
+    if (pPriv->converting)
+        NestedClientConvert(pPriv, x1, y1, x2 - x1, y2 - y1);
+
+    NestedClientPutImage(pPriv, x1, y1, x2 - x1, y2 - y1);
+    xcb_copy_area(pPriv->connection, pPriv->backing, pPriv->window,
+                  pPriv->gc, x1 - pPriv->viewport.x1, y1 - pPriv->viewport.y1,
+                  x1 - pPriv->viewport.x1, y1 - pPriv->viewport.y1,
+                  x2 - x1, y2 - y1);
+
     xcb_aux_sync(pPriv->connection);
+
+    NESTED_STATS_ADD(pPriv->stats, uploads, 1);
+    NESTED_STATS_ADD(pPriv->stats, uploadBytes,
+                     (uint64_t)(x2 - x1) * (y2 - y1) * pPriv->img->bpp / 8);
+    NESTED_STATS_ADD(pPriv->stats, roundTrips, 1);
+    NestedStatsUploaded(pPriv->stats);
 }
 
-void
-NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
-    xcb_generic_event_t *ev;
-    xcb_expose_event_t *xev;
-    xcb_motion_notify_event_t *mev;
-    xcb_button_press_event_t *bev;
-    xcb_key_press_event_t *kev;
+/* Merges the damage into what the uploader has yet to send; while it is
+ * busy with a slow host, frames coalesce instead of piling up. */
+static void
+NestedClientQueueUpload(NestedClientPrivatePtr pPriv, int x1, int y1,
+                        int x2, int y2) {
+    pthread_mutex_lock(&pPriv->queueLock);
+
+    if (!pPriv->queued) {
+        pPriv->queue.x1 = x1;
+        pPriv->queue.y1 = y1;
+        pPriv->queue.x2 = x2;
+        pPriv->queue.y2 = y2;
+        pPriv->queued = TRUE;
+        pthread_cond_signal(&pPriv->queueCond);
+    } else {
+        NESTED_STATS_ADD(pPriv->stats, coalesced, 1);
+        pPriv->queue.x1 = min(pPriv->queue.x1, x1);
+        pPriv->queue.y1 = min(pPriv->queue.y1, y1);
+        pPriv->queue.x2 = max(pPriv->queue.x2, x2);
+        pPriv->queue.y2 = max(pPriv->queue.y2, y2);
+    }
 
-    while (TRUE) {
-        ev = xcb_poll_for_event(pPriv->connection);
+    pthread_mutex_unlock(&pPriv->queueLock);
+}
 
-        if (!ev) {
-            if (xcb_connection_has_error(pPriv->connection))
-                exit(1);
+static void *
+NestedClientUploader(void *data) {
+    NestedClientPrivatePtr pPriv = data;
+    BoxRec box;
+
+    pthread_mutex_lock(&pPriv->queueLock);
+
+    for (;;) {
+        while (!pPriv->queued && !pPriv->quit)
+            pthread_cond_wait(&pPriv->queueCond, &pPriv->queueLock);
 
+        if (pPriv->quit)
             break;
+
+        box = pPriv->queue;
+        pPriv->queued = FALSE;
+        pthread_mutex_unlock(&pPriv->queueLock);
+
+        pthread_mutex_lock(&pPriv->uploadLock);
+        NestedClientUpload(pPriv, box.x1, box.y1, box.x2, box.y2);
+        pthread_mutex_unlock(&pPriv->uploadLock);
+
+        pthread_mutex_lock(&pPriv->queueLock);
+    }
+
+    pthread_mutex_unlock(&pPriv->queueLock);
+    return NULL;
+}
+
+static Bool
+NestedXcbSetAsync(NestedClientPrivatePtr pPriv) {
+    sigset_t all, saved;
+    int err;
+
+    if (pPriv->async)
+        return TRUE;
+
+    pthread_mutex_init(&pPriv->queueLock, NULL);
+    pthread_mutex_init(&pPriv->uploadLock, NULL);
+    pthread_cond_init(&pPriv->queueCond, NULL);
+    pPriv->queued = FALSE;
+    pPriv->quit = FALSE;
+
+    /* Signals (SIGIO input, timers) must keep going to the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    err = pthread_create(&pPriv->uploader, NULL, NestedClientUploader, pPriv);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (err) {
+        pthread_cond_destroy(&pPriv->queueCond);
+        pthread_mutex_destroy(&pPriv->uploadLock);
+        pthread_mutex_destroy(&pPriv->queueLock);
+        return FALSE;
+    }
+
+    pPriv->async = TRUE;
+    pPriv->workers = NULL;
+    return TRUE;
+}
+
+static void
+NestedXcbUpdateScreen(NestedClientPrivatePtr pPriv, int x1,
+                      int y1, int x2, int y2) {
+    /* Drawing outside the viewport is never uploaded */
+    x1 = max(x1, pPriv->viewport.x1);
+    y1 = max(y1, pPriv->viewport.y1);
+    x2 = min(x2, pPriv->viewport.x2);
+    y2 = min(y2, pPriv->viewport.y2);
+
+    if (x1 >= x2 || y1 >= y2) {
+        NESTED_STATS_ADD(pPriv->stats, skipped, 1);
+        return;
+    }
+
+    /* Nobody can see the window: remember what changed and upload it
+     * once it becomes visible again. */
+    if (!NestedClientIsVisible(pPriv)) {
+        NESTED_STATS_ADD(pPriv->stats, coalesced, 1);
+
+        if (!pPriv->hasPending) {
+            pPriv->pending.x1 = x1;
+            pPriv->pending.y1 = y1;
+            pPriv->pending.x2 = x2;
+            pPriv->pending.y2 = y2;
+            pPriv->hasPending = TRUE;
+        } else {
+            pPriv->pending.x1 = min(pPriv->pending.x1, x1);
+            pPriv->pending.y1 = min(pPriv->pending.y1, y1);
+            pPriv->pending.x2 = max(pPriv->pending.x2, x2);
+            pPriv->pending.y2 = max(pPriv->pending.y2, y2);
         }
 
-        switch (ev->response_type & ~0x80) {
-        case XCB_EXPOSE:
-            xev = (xcb_expose_event_t *)ev;
-            NestedClientUpdateScreen(pPriv,
-                                     xev->x,
-                                     xev->y,
-                                     xev->x + xev->width,
-                                     xev->y + xev->height);
+        return;
+    }
+
+    if (pPriv->async) {
+        NestedClientQueueUpload(pPriv, x1, y1, x2, y2);
+        return;
+    }
+
+    NestedClientUpload(pPriv, x1, y1, x2, y2);
+}
+
+static void
+NestedXcbSetColor(NestedClientPrivatePtr pPriv, int index,
+                  uint16_t red, uint16_t green, uint16_t blue) {
+    if (!pPriv->converting || pPriv->conv.src != NESTED_FORMAT_C8)
+        return;
+
+    if (pPriv->async)
+        pthread_mutex_lock(&pPriv->uploadLock);
+
+    NestedConvertSetColor(&pPriv->conv, index, red, green, blue);
+
+    if (pPriv->async)
+        pthread_mutex_unlock(&pPriv->uploadLock);
+}
+
+/* Pixels only go through the palette when they are expanded, so a new
+ * palette means expanding everything shown once more. */
+static void
+NestedXcbUpdatePalette(NestedClientPrivatePtr pPriv) {
+    if (!pPriv->converting || pPriv->conv.src != NESTED_FORMAT_C8 ||
+        pPriv->parked)
+        return;
+
+    NestedXcbUpdateScreen(pPriv, pPriv->viewport.x1, pPriv->viewport.y1,
+                          pPriv->viewport.x2, pPriv->viewport.y2);
+}
+
+/* The screen got smaller: memory past the last row in use goes back to
+ * the system and is populated again on demand if the screen grows. */
+static void
+NestedXcbReleaseFrameBuffer(NestedClientPrivatePtr pPriv, int height) {
+    if (pPriv->fbFlags & NESTED_FB_LOCKED)
+        return;
+
+    NestedFbRelease(pPriv->img->data, pPriv->img->stride * height,
+                    pPriv->img->stride * pPriv->img->height,
+                    pPriv->imgPageSize, pPriv->usingShm);
+
+    if (pPriv->converting && !pPriv->sharedFb)
+        NestedFbRelease(pPriv->fb, pPriv->fbStride * height,
+                        pPriv->fbStride * pPriv->img->height,
+                        pPriv->fbPageSize, FALSE);
+}
+
+/* Pans the window over the framebuffer and sends the newly shown area */
+static void
+NestedXcbSetViewport(NestedClientPrivatePtr pPriv, int x, int y) {
+    int width = pPriv->viewport.x2 - pPriv->viewport.x1;
+    int height = pPriv->viewport.y2 - pPriv->viewport.y1;
+
+    if (x == pPriv->viewport.x1 && y == pPriv->viewport.y1)
+        return;
+
+    pPriv->viewport.x1 = x;
+    pPriv->viewport.y1 = y;
+    pPriv->viewport.x2 = x + width;
+    pPriv->viewport.y2 = y + height;
+
+    /* Whatever was pending is now covered by the full repaint */
+    pPriv->hasPending = FALSE;
+
+    if (!pPriv->parked)
+        NestedXcbUpdateScreen(pPriv, x, y, x + width, y + height);
+}
+
+/* Uploads the damage accumulated while the window was not visible */
+static void
+NestedClientFlushPending(NestedClientPrivatePtr pPriv) {
+    if (!pPriv->hasPending || pPriv->parked || !NestedClientIsVisible(pPriv))
+        return;
+
+    pPriv->hasPending = FALSE;
+    NestedXcbUpdateScreen(pPriv,
+                          pPriv->pending.x1, pPriv->pending.y1,
+                          pPriv->pending.x2, pPriv->pending.y2);
+}
+
+/* Checks whether the window manager has hidden (e.g. minimised) us */
+static void
+NestedClientUpdateWmState(NestedClientPrivatePtr pPriv) {
+    xcb_get_property_cookie_t prop_c;
+    xcb_get_property_reply_t *prop_r;
+    xcb_atom_t *atoms;
+    int i, n;
+
+    pPriv->hidden = FALSE;
+
+    prop_c = xcb_get_property(pPriv->connection, FALSE, pPriv->window,
+                              pPriv->netWmState, XCB_ATOM_ATOM, 0, 1024);
+    prop_r = xcb_get_property_reply(pPriv->connection, prop_c, NULL);
+    NESTED_STATS_ADD(pPriv->stats, roundTrips, 1);
+
+    if (!prop_r)
+        return;
+
+    atoms = xcb_get_property_value(prop_r);
+    n = xcb_get_property_value_length(prop_r) / sizeof(xcb_atom_t);
+
+    for (i = 0; i < n; i++)
+        if (atoms[i] == pPriv->netWmStateHidden)
+            pPriv->hidden = TRUE;
+
+    free(prop_r);
+}
+
+/* Changes the size of the viewport, keeping it inside the framebuffer, and
+ * sends the whole of it again. The framebuffer itself is never touched. */
+static void
+NestedClientSetViewportSize(NestedClientPrivatePtr pPriv, int width,
+                            int height) {
+    int x, y;
+
+    width = min(max(width, 1), pPriv->img->width);
+    height = min(max(height, 1), pPriv->img->height);
+    x = min(pPriv->viewport.x1, pPriv->img->width - width);
+    y = min(pPriv->viewport.y1, pPriv->img->height - height);
+
+    if (width == pPriv->viewport.x2 - pPriv->viewport.x1 &&
+        height == pPriv->viewport.y2 - pPriv->viewport.y1 &&
+        x == pPriv->viewport.x1 && y == pPriv->viewport.y1)
+        return;
+
+    /* The uploader reads the viewport and draws to the backing pixmap */
+    if (pPriv->async)
+        pthread_mutex_lock(&pPriv->uploadLock);
+
+    pPriv->viewport.x1 = x;
+    pPriv->viewport.y1 = y;
+    pPriv->viewport.x2 = x + width;
+    pPriv->viewport.y2 = y + height;
+    pPriv->hasPending = FALSE;
+
+    xcb_free_pixmap(pPriv->connection, pPriv->backing);
+    NestedClientCreateBacking(pPriv);
+
+    if (pPriv->async)
+        pthread_mutex_unlock(&pPriv->uploadLock);
+
+    if (pPriv->parked)
+        NestedClientFillBlack(pPriv, pPriv->window, 0, 0, width, height);
+    else
+        NestedXcbUpdateScreen(pPriv, x, y, x + width, y + height);
+}
+
+/* Called by the driver after a mode switch */
+static void
+NestedXcbResizeWindow(NestedClientPrivatePtr pPriv, int width,
+                      int height) {
+    uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+    uint32_t values[2];
+
+    if (width == pPriv->viewport.x2 - pPriv->viewport.x1 &&
+        height == pPriv->viewport.y2 - pPriv->viewport.y1)
+        return;
+
+    values[0] = width;
+    values[1] = height;
+    xcb_configure_window(pPriv->connection, pPriv->window, mask, values);
+
+    NestedClientSetViewportSize(pPriv, width, height);
+}
+
+static void
+NestedXcbSetResizeHandler(NestedClientPrivatePtr pPriv,
+                          NestedClientResizeProc proc, void *data) {
+    pPriv->resizeProc = proc;
+    pPriv->resizeData = data;
+}
+
+/* Translates window coordinates to framebuffer coordinates. The host
+ * pointer can't leave the window, so touching a window edge is reported
+ * as one pixel past the viewport to let the server pan. */
+static void
+NestedClientPostMotion(NestedClientPrivatePtr pPriv, DeviceIntPtr dev,
+                       int x, int y, uint64_t time) {
+    int width = pPriv->viewport.x2 - pPriv->viewport.x1;
+    int height = pPriv->viewport.y2 - pPriv->viewport.y1;
+
+    /* Tiles don't pan; the pointer just crosses into the next one */
+    if (pPriv->sharedFb) {
+        NestedInputPostMouseMotionEvent(dev, x + pPriv->tileX,
+                                        y + pPriv->tileY, time);
+        return;
+    }
+
+    if (x <= 0)
+        x = -1;
+    else if (x >= width - 1)
+        x = width;
+
+    if (y <= 0)
+        y = -1;
+    else if (y >= height - 1)
+        y = height;
+
+    NestedInputPostMouseMotionEvent(dev,
+                                    max(x + pPriv->viewport.x1, 0),
+                                    max(y + pPriv->viewport.y1, 0), time);
+}
+
+/* Finds the screen an event is for, by the window it was reported on */
+static NestedClientPrivatePtr
+NestedClientEventScreen(NestedClientHostPtr host, xcb_generic_event_t *ev) {
+    xcb_window_t window;
+    int i;
+
+    switch (ev->response_type & ~0x80) {
+    case XCB_EXPOSE:
+        window = ((xcb_expose_event_t *)ev)->window;
+        break;
+    case XCB_VISIBILITY_NOTIFY:
+        window = ((xcb_visibility_notify_event_t *)ev)->window;
+        break;
+    case XCB_MAP_NOTIFY:
+        window = ((xcb_map_notify_event_t *)ev)->window;
+        break;
+    case XCB_UNMAP_NOTIFY:
+        window = ((xcb_unmap_notify_event_t *)ev)->window;
+        break;
+    case XCB_CONFIGURE_NOTIFY:
+        window = ((xcb_configure_notify_event_t *)ev)->window;
+        break;
+    case XCB_PROPERTY_NOTIFY:
+        window = ((xcb_property_notify_event_t *)ev)->window;
+        break;
+    case XCB_MOTION_NOTIFY:
+    case XCB_KEY_PRESS:
+    case XCB_KEY_RELEASE:
+    case XCB_BUTTON_PRESS:
+    case XCB_BUTTON_RELEASE:
+        /* These share their layout */
+        window = ((xcb_key_press_event_t *)ev)->event;
+        break;
+    default:
+        return NULL;
+    }
+
+    for (i = 0; i < host->numScreens; i++)
+        if (host->screens[i]->window == window)
+            return host->screens[i];
+
+    return NULL;
+}
+
+static void
+NestedClientHandleEvent(NestedClientPrivatePtr pPriv, xcb_generic_event_t *ev) {
+    xcb_expose_event_t *xev;
+    xcb_motion_notify_event_t *mev;
+    xcb_button_press_event_t *bev;
+    xcb_key_press_event_t *kev;
+    xcb_visibility_notify_event_t *vev;
+    xcb_configure_notify_event_t *cev;
+    xcb_property_notify_event_t *pev;
+    /* Tiles post their input through the screen's first tile */
+    DeviceIntPtr dev = pPriv->inputOwner ? pPriv->inputOwner->dev : pPriv->dev;
+
+    switch (ev->response_type & ~0x80) {
+    case XCB_EXPOSE:
+        xev = (xcb_expose_event_t *)ev;
+
+        if (pPriv->parked)
+            NestedClientFillBlack(pPriv, pPriv->window,
+                                  xev->x, xev->y,
+                                  xev->width, xev->height);
+        else
+            xcb_copy_area(pPriv->connection, pPriv->backing,
+                          pPriv->window, pPriv->gc,
+                          xev->x, xev->y, xev->x, xev->y,
+                          xev->width, xev->height);
+
+        if (xev->count == 0)
+            xcb_flush(pPriv->connection);
+        break;
+    case XCB_VISIBILITY_NOTIFY:
+        vev = (xcb_visibility_notify_event_t *)ev;
+        pPriv->obscured = vev->state == XCB_VISIBILITY_FULLY_OBSCURED;
+        pPriv->visibilityChanged = TRUE;
+        break;
+    case XCB_MAP_NOTIFY:
+        pPriv->mapped = TRUE;
+        pPriv->visibilityChanged = TRUE;
+        break;
+    case XCB_UNMAP_NOTIFY:
+        pPriv->mapped = FALSE;
+        break;
+    case XCB_CONFIGURE_NOTIFY:
+        cev = (xcb_configure_notify_event_t *)ev;
+
+        pPriv->configuredWidth = cev->width;
+        pPriv->configuredHeight = cev->height;
+        pPriv->configured = TRUE;
+        break;
+    case XCB_PROPERTY_NOTIFY:
+        pev = (xcb_property_notify_event_t *)ev;
+
+        if (pev->atom == pPriv->netWmState)
+            pPriv->wmStateChanged = TRUE;
+        break;
+    case XCB_MOTION_NOTIFY:
+        if (!dev) {
+            NestedClientMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+            NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
             break;
-        case XCB_MOTION_NOTIFY:
-            if (!pPriv->dev) {
-                xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
-                break;
-            }
+        }
 
-            mev = (xcb_motion_notify_event_t *)ev;
-            NestedInputPostMouseMotionEvent(pPriv->dev,
-                                            mev->event_x,
-                                            mev->event_y);
+        mev = (xcb_motion_notify_event_t *)ev;
+        NestedClientPostMotion(pPriv, dev, mev->event_x, mev->event_y,
+                               NestedStatsHostTime(mev->time));
+        break;
+    case XCB_KEY_PRESS:
+        if (!dev) {
+            NestedClientMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+            NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
             break;
-        case XCB_KEY_PRESS:
-            if (!pPriv->dev) {
-                xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
-                break;
-            }
+        }
 
-            kev = (xcb_key_press_event_t *)ev;
-            NestedInputPostKeyboardEvent(pPriv->dev, kev->detail, TRUE);
+        kev = (xcb_key_press_event_t *)ev;
+        NestedInputPostKeyboardEvent(dev, kev->detail, TRUE,
+                                     NestedStatsHostTime(kev->time));
+        break;
+    case XCB_KEY_RELEASE:
+        if (!dev) {
+            NestedClientMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+            NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
             break;
-        case XCB_KEY_RELEASE:
-            if (!pPriv->dev) {
-                xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
-                break;
-            }
+        }
 
-            kev = (xcb_key_press_event_t *)ev;
-            NestedInputPostKeyboardEvent(pPriv->dev, kev->detail, FALSE);
+        kev = (xcb_key_press_event_t *)ev;
+        NestedInputPostKeyboardEvent(dev, kev->detail, FALSE,
+                                     NestedStatsHostTime(kev->time));
+        break;
+    case XCB_BUTTON_PRESS:
+        if (!dev) {
+            NestedClientMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+            NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
             break;
-        case XCB_BUTTON_PRESS:
-            if (!pPriv->dev) {
-                xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
-                break;
-            }
+        }
 
-            bev = (xcb_button_press_event_t *)ev;
-            NestedInputPostButtonEvent(pPriv->dev, bev->detail, TRUE);
+        bev = (xcb_button_press_event_t *)ev;
+        NestedInputPostButtonEvent(dev, bev->detail, TRUE,
+                                   NestedStatsHostTime(bev->time));
+        break;
+    case XCB_BUTTON_RELEASE:
+        if (!dev) {
+            NestedClientMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+            NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
             break;
-        case XCB_BUTTON_RELEASE:
-            if (!pPriv->dev) {
-                xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
-                break;
-            }
+        }
+
+        bev = (xcb_button_press_event_t *)ev;
+        NestedInputPostButtonEvent(dev, bev->detail, FALSE,
+                                   NestedStatsHostTime(bev->time));
+        break;
+    }
+}
+
+/* Reads everything pending on the host connection, for all the screens
+ * sharing it */
+static void
+NestedXcbCheckEvents(NestedClientPrivatePtr pPriv) {
+    NestedClientHostPtr host = pPriv->host;
+    NestedClientPrivatePtr target;
+    xcb_generic_event_t *ev;
+    uint64_t start = NestedStatsNow();
+
+    while (TRUE) {
+        ev = xcb_poll_for_event(host->connection);
+
+        if (!ev) {
+            if (xcb_connection_has_error(host->connection))
+                exit(1);
 
-            bev = (xcb_button_press_event_t *)ev;
-            NestedInputPostButtonEvent(pPriv->dev, bev->detail, FALSE);
             break;
         }
 
+        NESTED_STATS_ADD(pPriv->stats, eventsRead, 1);
+        if ((ev->response_type & ~0x80) == XCB_MAPPING_NOTIFY)
+            host->haveKeymap = FALSE;
+
+        target = NestedClientEventScreen(host, ev);
+        if (target)
+            NestedClientHandleEvent(target, ev);
+
         free(ev);
     }
+
+    NESTED_STATS_ADD(pPriv->stats, checks, 1);
+    NESTED_STATS_TIME(pPriv->stats, checkTime, start);
+}
+
+/* Follows host window resizes, reads the window manager state and uploads
+ * what piled up while the window was not visible, all of which the event
+ * handler only notes */
+static void
+NestedXcbProcessDeferred(NestedClientPrivatePtr pPriv) {
+    int width, height;
+
+    if (pPriv->configured) {
+        pPriv->configured = FALSE;
+        width = pPriv->configuredWidth;
+        height = pPriv->configuredHeight;
+
+        /* The user resized the host window: follow it, then let the
+         * driver tell RandR clients about the new screen size. */
+        if (width != pPriv->viewport.x2 - pPriv->viewport.x1 ||
+            height != pPriv->viewport.y2 - pPriv->viewport.y1) {
+            NestedClientSetViewportSize(pPriv, width, height);
+
+            if (pPriv->resizeProc)
+                pPriv->resizeProc(pPriv->resizeData,
+                                  pPriv->viewport.x2 - pPriv->viewport.x1,
+                                  pPriv->viewport.y2 - pPriv->viewport.y1);
+        }
+    }
+
+    if (pPriv->wmStateChanged) {
+        pPriv->wmStateChanged = FALSE;
+        NestedClientUpdateWmState(pPriv);
+        pPriv->visibilityChanged = TRUE;
+    }
+
+    if (pPriv->visibilityChanged) {
+        pPriv->visibilityChanged = FALSE;
+        NestedClientFlushPending(pPriv);
+    }
 }
 
-void
-NestedClientCloseScreen(NestedClientPrivatePtr pPriv) {
+static void
+NestedXcbCloseScreen(NestedClientPrivatePtr pPriv) {
+    if (pPriv->async) {
+        pthread_mutex_lock(&pPriv->queueLock);
+        pPriv->quit = TRUE;
+        pthread_cond_signal(&pPriv->queueCond);
+        pthread_mutex_unlock(&pPriv->queueLock);
+        pthread_join(pPriv->uploader, NULL);
+
+        pthread_cond_destroy(&pPriv->queueCond);
+        pthread_mutex_destroy(&pPriv->uploadLock);
+        pthread_mutex_destroy(&pPriv->queueLock);
+        pPriv->async = FALSE;
+    }
+
     if (pPriv->usingShm) {
         xcb_shm_detach(pPriv->connection, pPriv->shminfo.shmseg);
         shmdt(pPriv->shminfo.shmaddr);
+        shmctl(pPriv->shminfo.shmid, IPC_RMID, NULL);
+    } else {
+        NestedFbUnmap(pPriv->img->data, pPriv->imgMapSize);
     }
 
+    xcb_free_pixmap(pPriv->connection, pPriv->backing);
     xcb_image_destroy(pPriv->img);
-    XCloseDisplay(pPriv->display);
+    free(pPriv->scratch);
+
+    if (pPriv->converting && !pPriv->sharedFb)
+        NestedFbUnmap(pPriv->fb, pPriv->fbMapSize);
+
+    /* Other screens may still be using the connection */
+    xcb_destroy_window(pPriv->connection, pPriv->window);
+    xcb_free_gc(pPriv->connection, pPriv->gc);
+    xcb_flush(pPriv->connection);
+
+    NestedClientRemoveFromHost(pPriv->host, pPriv);
+    NestedClientPutHost(pPriv->host);
+    free(pPriv);
 }
 
-void
-NestedClientSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev) {
+static void
+NestedXcbSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev) {
     pPriv->dev = dev;
 }
 
-int
-NestedClientGetFileDescriptor(NestedClientPrivatePtr pPriv) {
+/* Screens sharing a connection share its descriptor, so only the first
+ * of them gets it; reading it handles events for all of them. */
+static int
+NestedXcbGetFileDescriptor(NestedClientPrivatePtr pPriv) {
+    if (pPriv->host->screens[0] != pPriv)
+        return -1;
+
     return xcb_get_file_descriptor(pPriv->connection);
 }
 
-Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr keySyms, CARD8 *modmap, XkbControlsPtr ctrls) {
+static Bool
+NestedClientFetchKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr keySyms, CARD8 *modmap, XkbControlsPtr ctrls) {
     int mapWidth;
     int min_keycode, max_keycode;
     int i, j;
@@ -524,12 +2026,12 @@ Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr ke
 
     xkb = XkbGetKeyboard(pPriv->display, XkbGBN_AllComponentsMask, XkbUseCoreKbd);
     if (xkb == NULL || xkb->geom == NULL) {
-        xf86DrvMsg(pPriv->scrnIndex, X_ERROR, "Couldn't get XKB keyboard.\n");
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR, "Couldn't get XKB keyboard.\n");
         return FALSE;
     }
 
     if(XkbGetControls(pPriv->display, XkbAllControlsMask, xkb) != Success) {
-        xf86DrvMsg(pPriv->scrnIndex, X_ERROR, "Couldn't get XKB keyboard controls.\n");
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR, "Couldn't get XKB keyboard controls.\n");
         return FALSE;
     }
 
@@ -537,3 +2039,73 @@ Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr ke
     XkbFreeKeyboard(xkb, 0, False);
     return TRUE;
 }
+
+static KeySym *
+NestedClientCopyKeymap(const KeySymsRec *keySyms) {
+    size_t len = (size_t)(keySyms->maxKeyCode - keySyms->minKeyCode + 1) *
+                 keySyms->mapWidth;
+    KeySym *map = malloc(len * sizeof(KeySym));
+
+    if (map)
+        memcpy(map, keySyms->map, len * sizeof(KeySym));
+
+    return map;
+}
+
+/* The XKB transfer takes several round trips, so the result is kept on
+ * the host connection and reused by its screens and by later server
+ * generations until the host sends a MappingNotify. */
+static Bool
+NestedXcbGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr keySyms, CARD8 *modmap, XkbControlsPtr ctrls) {
+    NestedClientHostPtr host = pPriv->host;
+
+    if (!host->haveKeymap) {
+        free(host->keySyms.map);
+        host->keySyms.map = NULL;
+
+        if (!NestedClientFetchKeyboardMappings(pPriv, &host->keySyms,
+                                               host->modmap, &host->ctrls))
+            return FALSE;
+
+        host->haveKeymap = TRUE;
+    }
+
+    *keySyms = host->keySyms;
+    keySyms->map = NestedClientCopyKeymap(&host->keySyms);
+    if (!keySyms->map)
+        return FALSE;
+
+    memcpy(modmap, host->modmap, sizeof(CARD8) * MAP_LENGTH);
+    memcpy(ctrls, &host->ctrls, sizeof(XkbControlsRec));
+    return TRUE;
+}
+
+const NestedClientBackendRec nestedXcbBackend = {
+    "xcb",
+    NestedXcbCheckDisplay,
+    NestedXcbValidDepth,
+    NestedXcbProbe,
+    NestedXcbCreateScreen,
+    NestedXcbStartScreen,
+    NestedXcbFinishScreen,
+    NestedXcbCreateTile,
+    NestedXcbGetFrameBuffer,
+    NestedXcbSetAsync,
+    NestedXcbUpdateScreen,
+    NestedXcbSetColor,
+    NestedXcbUpdatePalette,
+    NestedXcbSetWorkers,
+    NestedXcbSetStats,
+    NestedXcbReleaseFrameBuffer,
+    NestedXcbSetViewport,
+    NestedXcbResizeWindow,
+    NestedXcbSetResizeHandler,
+    NestedXcbHideCursor,
+    NestedXcbSetParked,
+    NestedXcbCheckEvents,
+    NestedXcbProcessDeferred,
+    NestedXcbCloseScreen,
+    NestedXcbSetDevicePtr,
+    NestedXcbGetFileDescriptor,
+    NestedXcbGetKeyboardMappings
+};
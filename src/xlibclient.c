@@ -29,7 +29,9 @@
  * Nathaniel Way <nathanielcw@hotmail.com>
  */
 
+
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/ipc.h>
 #include <sys/shm.h>
@@ -51,12 +53,13 @@
 #include "nested_input.h"
 
 struct NestedClientPrivate {
+    NestedClientBackendPtr backend;
     Display *display;
     int screenNumber;
     Screen *screen;
     Window rootWindow;
     Window window;
-    XImage *img;
+    XImage *img; /* the nested framebuffer, in the host's format */
     GC gc;
     Bool usingShm;
     XShmSegmentInfo shminfo;
@@ -64,6 +67,11 @@ struct NestedClientPrivate {
     Cursor mycursor; /* Test cursor */
     Pixmap bitmapNoData;
     XColor color1;
+    BoxRec viewport; /* part of the framebuffer shown in the window */
+    NestedStatsPtr stats; /* owned by the driver */
+    NestedClientResizeProc resizeProc;
+    void *resizeData;
+    Bool parked;
     DeviceIntPtr dev; // The pointer to the input device.  Passed back to the
                       // input driver when posting input events.
 
@@ -76,9 +84,17 @@ struct NestedClientPrivate {
     } xkb;
 };
 
+struct NestedClientPendingScreen {
+    NestedClientBackendPtr backend;
+    NestedClientPrivatePtr pPriv;
+    uint32_t redMask, greenMask, blueMask;
+};
+
+static void NestedXlibHideCursor(NestedClientPrivatePtr pPriv);
+
 /* Checks if a display is open */
-Bool
-NestedClientCheckDisplay(char *displayName) {
+static Bool
+NestedXlibCheckDisplay(char *displayName) {
     Display *d;
 
     d = XOpenDisplay(displayName);
@@ -90,10 +106,69 @@ NestedClientCheckDisplay(char *displayName) {
     }
 }
 
-Bool
-NestedClientValidDepth(int depth) {
-    /* XXX: implement! */
-    return TRUE;
+/* The framebuffer is the host image, so there is no palette expansion;
+ * CreateScreen checks the host has the same depth */
+static Bool
+NestedXlibValidDepth(int depth) {
+    return depth == 16 || depth == 24 || depth == 30;
+}
+
+static Bool nestedXShmFailed;
+
+static int
+NestedClientXShmErrorHandler(Display *d, XErrorEvent *e) {
+    nestedXShmFailed = TRUE;
+    return 0;
+}
+
+/* Attaches a segment, trapping the error a host that can't reach our
+ * memory (a remote one) answers with instead of letting Xlib exit */
+static Bool
+NestedClientXShmAttach(Display *d, XShmSegmentInfo *shminfo) {
+    int (*oldHandler)(Display *, XErrorEvent *);
+
+    XSync(d, False);
+    nestedXShmFailed = FALSE;
+    oldHandler = XSetErrorHandler(NestedClientXShmErrorHandler);
+    XShmAttach(d, shminfo);
+    XSync(d, False);
+    XSetErrorHandler(oldHandler);
+
+    return !nestedXShmFailed;
+}
+
+/* XShmQueryExtension doesn't tell whether the host can attach our
+ * segments, so a test segment is attached */
+static int
+NestedXlibProbe(char *displayName) {
+    XShmSegmentInfo shminfo;
+    Display *d;
+    int transport = NESTED_TRANSPORT_COPY;
+
+    d = XOpenDisplay(displayName);
+    if (!d)
+        return NESTED_TRANSPORT_NONE;
+
+    shminfo.shmid = XShmQueryExtension(d) ?
+                    shmget(IPC_PRIVATE, 4096, IPC_CREAT | 0600) : -1;
+    if (shminfo.shmid != -1) {
+        shminfo.shmaddr = shmat(shminfo.shmid, NULL, 0);
+        shminfo.readOnly = TRUE;
+
+        if (shminfo.shmaddr != (char *)-1) {
+            if (NestedClientXShmAttach(d, &shminfo)) {
+                XShmDetach(d, &shminfo);
+                XSync(d, False);
+                transport = NESTED_TRANSPORT_SHM;
+            }
+            shmdt(shminfo.shmaddr);
+        }
+
+        shmctl(shminfo.shmid, IPC_RMID, NULL);
+    }
+
+    XCloseDisplay(d);
+    return transport;
 }
 
 static Bool
@@ -128,11 +203,10 @@ NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int
         return FALSE;
     }
 
-    /* XXX: change the 0777 mask? */
     pPriv->shminfo.shmid = shmget(IPC_PRIVATE,
                                   pPriv->img->bytes_per_line *
                                   pPriv->img->height,
-                                  IPC_CREAT | 0777);
+                                  IPC_CREAT | 0600);
 
     if (pPriv->shminfo.shmid == -1) {
         xf86DrvMsg(scrnIndex, X_ERROR, "shmget failed.  Dropping XShm support.\n");
@@ -144,48 +218,84 @@ NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int
 
     if (pPriv->shminfo.shmaddr == (char *) -1) {
         xf86DrvMsg(scrnIndex, X_ERROR, "shmaddr failed.  Dropping XShm support.\n");
+        shmctl(pPriv->shminfo.shmid, IPC_RMID, NULL);
         XDestroyImage(pPriv->img);
         return FALSE;
     }
 
     pPriv->img->data = pPriv->shminfo.shmaddr;
     pPriv->shminfo.readOnly = FALSE;
-    XShmAttach(pPriv->display, &pPriv->shminfo);
+
+    if (!NestedClientXShmAttach(pPriv->display, &pPriv->shminfo)) {
+        xf86DrvMsg(scrnIndex, X_INFO,
+                   "XShmAttach failed.  Dropping XShm support.\n");
+        shmdt(pPriv->shminfo.shmaddr);
+        shmctl(pPriv->shminfo.shmid, IPC_RMID, NULL);
+        pPriv->img->data = NULL;
+        XDestroyImage(pPriv->img);
+        return FALSE;
+    }
+
     pPriv->usingShm = TRUE;
 
     return TRUE;
 }
 
+static void
+NestedXlibSetSizeHints(NestedClientPrivatePtr pPriv, int width, int height) {
+    XSizeHints sizeHints;
 
-NestedClientPrivatePtr
-NestedClientCreateScreen(int scrnIndex,
-                         char *displayName,
-                         int width,
-                         int height,
-                         int originX,
-                         int originY,
-                         int depth,
-                         int bitsPerPixel,
-                         Pixel *retRedMask,
-                         Pixel *retGreenMask,
-                         Pixel *retBlueMask) {
+    sizeHints.flags = PPosition | PSize | PMinSize | PMaxSize;
+    sizeHints.min_width = width;
+    sizeHints.max_width = width;
+    sizeHints.min_height = height;
+    sizeHints.max_height = height;
+    XSetWMNormalHints(pPriv->display, pPriv->window, &sizeHints);
+}
+
+static NestedClientPrivatePtr
+NestedXlibCreateScreen(int scrnIndex,
+                       char *displayName,
+                       int width,
+                       int height,
+                       int windowWidth,
+                       int windowHeight,
+                       int originX,
+                       int originY,
+                       int depth,
+                       int bitsPerPixel,
+                       int transportDepth,
+                       unsigned int fbFlags,
+                       uint32_t *retRedMask,
+                       uint32_t *retGreenMask,
+                       uint32_t *retBlueMask) {
     NestedClientPrivatePtr pPriv;
-    XSizeHints sizeHints;
     Bool supported;
     char windowTitle[32];
 
-    pPriv = malloc(sizeof(struct NestedClientPrivate));
+    if (transportDepth)
+        xf86DrvMsg(scrnIndex, X_WARNING,
+                   "The xlib backend ignores \"TransportDepth\"\n");
+
+    pPriv = calloc(1, sizeof(struct NestedClientPrivate));
+    if (!pPriv)
+        return NULL;
+
+    pPriv->backend = &nestedXlibBackend;
     pPriv->scrnIndex = scrnIndex;
 
     pPriv->display = XOpenDisplay(displayName);
-    if (!pPriv->display)
+    if (!pPriv->display) {
+        free(pPriv);
         return NULL;
+    }
 
     supported = XkbQueryExtension(pPriv->display, &pPriv->xkb.op, &pPriv->xkb.event,
                                   &pPriv->xkb.error, &pPriv->xkb.major, &pPriv->xkb.minor);
     if (!supported) {
         xf86DrvMsg(pPriv->scrnIndex, X_ERROR, "The remote server does not support the XKEYBOARD extension.\n");
         XCloseDisplay(pPriv->display);
+        free(pPriv);
         return NULL;
     }
 
@@ -194,15 +304,20 @@ NestedClientCreateScreen(int scrnIndex,
     pPriv->rootWindow = RootWindow(pPriv->display, pPriv->screenNumber);
     pPriv->gc = DefaultGC(pPriv->display, pPriv->screenNumber);
 
+    /* Without conversion the framebuffer has to be in the host's format */
+    if (DefaultDepthOfScreen(pPriv->screen) != depth) {
+        xf86DrvMsg(scrnIndex, X_ERROR,
+                   "The xlib backend needs the host's depth (%d)\n",
+                   DefaultDepthOfScreen(pPriv->screen));
+        XCloseDisplay(pPriv->display);
+        free(pPriv);
+        return NULL;
+    }
+
     pPriv->window = XCreateSimpleWindow(pPriv->display, pPriv->rootWindow,
-    originX, originY, width, height, 0, 0, 0);
+    originX, originY, windowWidth, windowHeight, 0, 0, 0);
 
-    sizeHints.flags = PPosition | PSize | PMinSize | PMaxSize;
-    sizeHints.min_width = width;
-    sizeHints.max_width = width;
-    sizeHints.min_height = height;
-    sizeHints.max_height = height;
-    XSetWMNormalHints(pPriv->display, pPriv->window, &sizeHints);
+    NestedXlibSetSizeHints(pPriv, windowWidth, windowHeight);
 
     snprintf(windowTitle, sizeof(windowTitle), "Screen %d", scrnIndex);
 
@@ -227,17 +342,34 @@ NestedClientCreateScreen(int scrnIndex,
                               32, /* XXX: bitmap_pad */
                               0 /* XXX: bytes_per_line */);
 
-        if (!pPriv->img)
+        if (!pPriv->img) {
+            XCloseDisplay(pPriv->display);
+            free(pPriv);
             return NULL;
+        }
 
         pPriv->img->data = malloc(pPriv->img->bytes_per_line * pPriv->img->height);
         pPriv->usingShm = FALSE;
     }
 
-    if (!pPriv->img->data)
+    if (!pPriv->img->data) {
+        XDestroyImage(pPriv->img);
+        XCloseDisplay(pPriv->display);
+        free(pPriv);
         return NULL;
+    }
+
+    if (pPriv->img->bits_per_pixel != bitsPerPixel)
+        xf86DrvMsg(scrnIndex, X_WARNING,
+                   "Host image has %d bpp, the screen %d\n",
+                   pPriv->img->bits_per_pixel, bitsPerPixel);
 
-    NestedClientHideCursor(pPriv); /* Hide cursor */
+    pPriv->viewport.x1 = 0;
+    pPriv->viewport.y1 = 0;
+    pPriv->viewport.x2 = windowWidth;
+    pPriv->viewport.y2 = windowHeight;
+
+    NestedXlibHideCursor(pPriv); /* Hide cursor */
 
 #if 0
 xf86DrvMsg(scrnIndex, X_INFO, "width: %d\n", pPriv->img->width);
@@ -254,20 +386,83 @@ xf86DrvMsg(scrnIndex, X_INFO, "blu_mask: 0x%lx\n", pPriv->img->blue_mask);
     *retGreenMask = pPriv->img->green_mask;
     *retBlueMask = pPriv->img->blue_mask;
 
-    XEvent ev;
-    while (1) {
-        XNextEvent(pPriv->display, &ev);
-        if (ev.type == Expose) {
-            break;
-        }
-    }
-   
+    /* Not waiting for the window to be exposed: a window manager may
+     * never map it, and the Expose is handled with the other events */
     pPriv->dev = (DeviceIntPtr)NULL;
  
     return pPriv;
 }
 
-void NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
+/* Xlib screens are set up synchronously */
+static NestedClientPendingPtr
+NestedXlibStartScreen(int scrnIndex,
+                      char *displayName,
+                      int width,
+                      int height,
+                      int windowWidth,
+                      int windowHeight,
+                      int originX,
+                      int originY,
+                      int depth,
+                      int bitsPerPixel,
+                      int transportDepth,
+                      unsigned int fbFlags) {
+    NestedClientPendingPtr pending;
+
+    pending = calloc(1, sizeof(struct NestedClientPendingScreen));
+    if (!pending)
+        return NULL;
+
+    pending->backend = &nestedXlibBackend;
+    pending->pPriv = NestedXlibCreateScreen(scrnIndex, displayName, width,
+                                            height, windowWidth, windowHeight,
+                                            originX, originY, depth,
+                                            bitsPerPixel, transportDepth,
+                                            fbFlags, &pending->redMask,
+                                            &pending->greenMask,
+                                            &pending->blueMask);
+    return pending;
+}
+
+static NestedClientPrivatePtr
+NestedXlibFinishScreen(NestedClientPendingPtr pending,
+                       uint32_t *retRedMask,
+                       uint32_t *retGreenMask,
+                       uint32_t *retBlueMask) {
+    NestedClientPrivatePtr pPriv = pending->pPriv;
+
+    *retRedMask = pending->redMask;
+    *retGreenMask = pending->greenMask;
+    *retBlueMask = pending->blueMask;
+    free(pending);
+
+    return pPriv;
+}
+
+/* Tiles and mirrors copy out of a shared framebuffer, which needs the
+ * conversion code of the xcb backend */
+static NestedClientPrivatePtr
+NestedXlibCreateTile(int scrnIndex,
+                     char *displayName,
+                     char *fb,
+                     int fbStride,
+                     int x,
+                     int y,
+                     int width,
+                     int height,
+                     int originX,
+                     int originY,
+                     int depth,
+                     int bitsPerPixel,
+                     int transportDepth,
+                     NestedClientPrivatePtr inputOwner) {
+    xf86DrvMsg(scrnIndex, X_ERROR,
+               "The xlib backend doesn't support tiles or mirrors\n");
+    return NULL;
+}
+
+static void
+NestedXlibHideCursor(NestedClientPrivatePtr pPriv) {
     char noData[]= {0,0,0,0,0,0,0,0};
     pPriv->color1.red = pPriv->color1.green = pPriv->color1.blue = 0;
 
@@ -282,98 +477,217 @@ void NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
     XFreeCursor(pPriv->display, pPriv->mycursor);
 }
 
-char *
-NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv) {
+static char *
+NestedXlibGetFrameBuffer(NestedClientPrivatePtr pPriv) {
     return pPriv->img->data;
 }
 
-void
-NestedClientUpdateScreen(NestedClientPrivatePtr pPriv, int16_t x1,
-                          int16_t y1, int16_t x2, int16_t y2) {
+static Bool
+NestedXlibSetAsync(NestedClientPrivatePtr pPriv) {
+    return FALSE;
+}
+
+static void
+NestedXlibUpdateScreen(NestedClientPrivatePtr pPriv, int x1,
+                       int y1, int x2, int y2) {
+    /* Drawing outside the viewport is never uploaded */
+    x1 = max(x1, pPriv->viewport.x1);
+    y1 = max(y1, pPriv->viewport.y1);
+    x2 = min(x2, pPriv->viewport.x2);
+    y2 = min(y2, pPriv->viewport.y2);
+
+    if (x1 >= x2 || y1 >= y2) {
+        NESTED_STATS_ADD(pPriv->stats, skipped, 1);
+        return;
+    }
+
+    NESTED_STATS_ADD(pPriv->stats, uploads, 1);
+    NESTED_STATS_ADD(pPriv->stats, uploadBytes,
+                     (uint64_t)(x2 - x1) * (y2 - y1) *
+                     pPriv->img->bits_per_pixel / 8);
+
     if (pPriv->usingShm) {
         XShmPutImage(pPriv->display, pPriv->window, pPriv->gc, pPriv->img,
-                     x1, y1, x1, y1, x2 - x1, y2 - y1, FALSE);
+                     x1, y1, x1 - pPriv->viewport.x1, y1 - pPriv->viewport.y1,
+                     x2 - x1, y2 - y1, FALSE);
         /* Without this sync we get some freezes, probably due to some lock
          * in the shm usage */
         XSync(pPriv->display, FALSE);
+        NESTED_STATS_ADD(pPriv->stats, roundTrips, 1);
     } else {
         XPutImage(pPriv->display, pPriv->window, pPriv->gc, pPriv->img,
-                  x1, y1, x1, y1, x2 - x1, y2 - y1);
+                  x1, y1, x1 - pPriv->viewport.x1, y1 - pPriv->viewport.y1,
+                  x2 - x1, y2 - y1);
+        XFlush(pPriv->display);
+    }
+
+    NestedStatsUploaded(pPriv->stats);
+}
+
+static void
+NestedXlibSetColor(NestedClientPrivatePtr pPriv, int index,
+                   uint16_t red, uint16_t green, uint16_t blue) {
+}
+
+static void
+NestedXlibUpdatePalette(NestedClientPrivatePtr pPriv) {
+}
+
+static void
+NestedXlibSetWorkers(NestedClientPrivatePtr pPriv, NestedWorkersPtr workers) {
+}
+
+static void
+NestedXlibSetStats(NestedClientPrivatePtr pPriv, NestedStatsPtr stats) {
+    pPriv->stats = stats;
+}
+
+/* The framebuffer is the host image, which stays allocated */
+static void
+NestedXlibReleaseFrameBuffer(NestedClientPrivatePtr pPriv, int height) {
+}
+
+static void
+NestedXlibSetViewport(NestedClientPrivatePtr pPriv, int x, int y) {
+    pPriv->viewport.x2 += x - pPriv->viewport.x1;
+    pPriv->viewport.y2 += y - pPriv->viewport.y1;
+    pPriv->viewport.x1 = x;
+    pPriv->viewport.y1 = y;
+
+    if (!pPriv->parked)
+        NestedXlibUpdateScreen(pPriv, pPriv->viewport.x1, pPriv->viewport.y1,
+                               pPriv->viewport.x2, pPriv->viewport.y2);
+}
+
+static void
+NestedXlibResizeWindow(NestedClientPrivatePtr pPriv, int width, int height) {
+    pPriv->viewport.x2 = pPriv->viewport.x1 + width;
+    pPriv->viewport.y2 = pPriv->viewport.y1 + height;
+
+    NestedXlibSetSizeHints(pPriv, width, height);
+    XResizeWindow(pPriv->display, pPriv->window, width, height);
+    XFlush(pPriv->display);
+}
+
+/* The window has a fixed size, the handler is never called */
+static void
+NestedXlibSetResizeHandler(NestedClientPrivatePtr pPriv,
+                           NestedClientResizeProc proc, void *data) {
+    pPriv->resizeProc = proc;
+    pPriv->resizeData = data;
+}
+
+static void
+NestedXlibSetParked(NestedClientPrivatePtr pPriv, Bool parked) {
+    pPriv->parked = parked;
+
+    if (parked) {
+        XClearWindow(pPriv->display, pPriv->window);
+        XFlush(pPriv->display);
     }
 }
 
-void
-NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
+static void
+NestedXlibCheckEvents(NestedClientPrivatePtr pPriv) {
     XEvent ev;
+    uint64_t start = NestedStatsNow();
 
     while(XCheckMaskEvent(pPriv->display, ~0, &ev)) {
+        NESTED_STATS_ADD(pPriv->stats, eventsRead, 1);
+
         switch (ev.type) {
         case Expose:
-            NestedClientUpdateScreen(pPriv,
-                                     ((XExposeEvent*)&ev)->x,
-                                     ((XExposeEvent*)&ev)->y,
-                                     ((XExposeEvent*)&ev)->x + 
-                                     ((XExposeEvent*)&ev)->width,
-                                     ((XExposeEvent*)&ev)->y + 
-                                     ((XExposeEvent*)&ev)->height);
+            if (pPriv->parked)
+                break;
+
+            NestedXlibUpdateScreen(pPriv,
+                                   pPriv->viewport.x1 +
+                                   ((XExposeEvent*)&ev)->x,
+                                   pPriv->viewport.y1 +
+                                   ((XExposeEvent*)&ev)->y,
+                                   pPriv->viewport.x1 +
+                                   ((XExposeEvent*)&ev)->x + 
+                                   ((XExposeEvent*)&ev)->width,
+                                   pPriv->viewport.y1 +
+                                   ((XExposeEvent*)&ev)->y + 
+                                   ((XExposeEvent*)&ev)->height);
             break;
 
         case MotionNotify:
             if (!pPriv->dev) {
                 xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+                NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
                 break;
             }
 
             NestedInputPostMouseMotionEvent(pPriv->dev,
+                                            pPriv->viewport.x1 +
                                             ((XMotionEvent*)&ev)->x,
-                                            ((XMotionEvent*)&ev)->y);
+                                            pPriv->viewport.y1 +
+                                            ((XMotionEvent*)&ev)->y,
+                                            NestedStatsHostTime(ev.xmotion.time));
             break;
 
         case ButtonPress:
         case ButtonRelease:
             if (!pPriv->dev) {
                 xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+                NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
                 break;
             }
 
-            NestedInputPostButtonEvent(pPriv->dev, ev.xbutton.button, ev.type == ButtonPress);
+            NestedInputPostButtonEvent(pPriv->dev, ev.xbutton.button, ev.type == ButtonPress,
+                                       NestedStatsHostTime(ev.xbutton.time));
             break;
 
         case KeyPress:
         case KeyRelease:
             if (!pPriv->dev) {
                 xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+                NESTED_STATS_ADD(pPriv->stats, eventsDropped, 1);
                 break;
             }
 
-            NestedInputPostKeyboardEvent(pPriv->dev, ev.xkey.keycode, ev.type == KeyPress);
+            NestedInputPostKeyboardEvent(pPriv->dev, ev.xkey.keycode, ev.type == KeyPress,
+                                         NestedStatsHostTime(ev.xkey.time));
             break;
         }
     }
+
+    NESTED_STATS_ADD(pPriv->stats, checks, 1);
+    NESTED_STATS_TIME(pPriv->stats, checkTime, start);
+}
+
+static void
+NestedXlibProcessDeferred(NestedClientPrivatePtr pPriv) {
 }
 
-void
-NestedClientCloseScreen(NestedClientPrivatePtr pPriv) {
+static void
+NestedXlibCloseScreen(NestedClientPrivatePtr pPriv) {
     if (pPriv->usingShm) {
         XShmDetach(pPriv->display, &pPriv->shminfo);
         shmdt(pPriv->shminfo.shmaddr);
+        shmctl(pPriv->shminfo.shmid, IPC_RMID, NULL);
+        pPriv->img->data = NULL; /* not for XDestroyImage to free */
     }
 
     XDestroyImage(pPriv->img);
     XCloseDisplay(pPriv->display);
+    free(pPriv);
 }
 
-void
-NestedClientSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev) {
+static void
+NestedXlibSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev) {
     pPriv->dev = dev;
 }
 
-int
-NestedClientGetFileDescriptor(NestedClientPrivatePtr pPriv) {
+static int
+NestedXlibGetFileDescriptor(NestedClientPrivatePtr pPriv) {
     return ConnectionNumber(pPriv->display);
 }
 
-Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr keySyms, CARD8 *modmap, XkbControlsPtr ctrls) {
+static Bool
+NestedXlibGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr keySyms, CARD8 *modmap, XkbControlsPtr ctrls) {
     XModifierKeymap *modifier_keymap;
     KeySym *keymap;
     int mapWidth;
@@ -419,3 +733,33 @@ Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr ke
     XkbFreeKeyboard(xkb, 0, False);
     return TRUE;
 }
+
+const NestedClientBackendRec nestedXlibBackend = {
+    "xlib",
+    NestedXlibCheckDisplay,
+    NestedXlibValidDepth,
+    NestedXlibProbe,
+    NestedXlibCreateScreen,
+    NestedXlibStartScreen,
+    NestedXlibFinishScreen,
+    NestedXlibCreateTile,
+    NestedXlibGetFrameBuffer,
+    NestedXlibSetAsync,
+    NestedXlibUpdateScreen,
+    NestedXlibSetColor,
+    NestedXlibUpdatePalette,
+    NestedXlibSetWorkers,
+    NestedXlibSetStats,
+    NestedXlibReleaseFrameBuffer,
+    NestedXlibSetViewport,
+    NestedXlibResizeWindow,
+    NestedXlibSetResizeHandler,
+    NestedXlibHideCursor,
+    NestedXlibSetParked,
+    NestedXlibCheckEvents,
+    NestedXlibProcessDeferred,
+    NestedXlibCloseScreen,
+    NestedXlibSetDevicePtr,
+    NestedXlibGetFileDescriptor,
+    NestedXlibGetKeyboardMappings
+};
@@ -0,0 +1,346 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Replays a damage trace recorded with Option "DamageTrace" through the
+ * upload path of any client backend, so upload strategies can be
+ * compared on the same workload.
+ *
+ * Usage: nested-replay [-b backend] [-d display] [-s speed] [-r] [-a]
+ *                      [-w threads] trace
+ *
+ *   -b  backend to upload with, as Option "Backend"
+ *   -d  display to show it on, as Option "Display"
+ *   -s  playback speed; 0 replays as fast as possible (default 1)
+ *   -r  upload each damage rectangle, not their extents as the driver does
+ *   -a  upload from a thread of its own, as for mirrors
+ *   -w  conversion threads, as Option "UpdateThreads"
+ *
+ * Traces without pixels get each damaged rectangle painted a new shade,
+ * so conversions have the same amount of work to do. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "client.h"
+#include "nested_trace.h"
+#include "stats.h"
+#include "workers.h"
+
+#include "nested_input.h"
+
+static void
+Usage(void) {
+    fprintf(stderr, "usage: nested-replay [-b backend] [-d display] "
+                    "[-s speed] [-r] [-a] [-w threads] trace\n");
+    exit(2);
+}
+
+static void
+Read(FILE *f, void *data, size_t size) {
+    if (size && fread(data, size, 1, f) != 1) {
+        fprintf(stderr, "nested-replay: truncated trace\n");
+        exit(1);
+    }
+}
+
+/* Rectangles index the framebuffer, so a corrupt trace is rejected */
+static void
+CheckRects(const NestedTraceRect *rects, uint32_t numRects,
+           const NestedTraceHeader *header) {
+    uint32_t i;
+
+    for (i = 0; i < numRects; i++)
+        if (rects[i].x1 < 0 || rects[i].y1 < 0 ||
+            rects[i].x1 > rects[i].x2 || rects[i].y1 > rects[i].y2 ||
+            (uint32_t)rects[i].x2 > header->width ||
+            (uint32_t)rects[i].y2 > header->height) {
+            fprintf(stderr, "nested-replay: rectangle %d,%d-%d,%d is "
+                            "outside the %ux%u screen\n",
+                    rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2,
+                    header->width, header->height);
+            exit(1);
+        }
+}
+
+static void
+WaitUntil(uint64_t time) {
+    uint64_t now = NestedStatsNow();
+    struct timespec delay;
+
+    if (time <= now)
+        return;
+
+    delay.tv_sec = (time - now) / 1000000000;
+    delay.tv_nsec = (time - now) % 1000000000;
+    nanosleep(&delay, NULL);
+}
+
+int
+main(int argc, char **argv) {
+    NestedClientBackendPtr backend;
+    NestedClientPrivatePtr pPriv;
+    NestedWorkersPtr workers = NULL;
+    NestedStatsPtr stats;
+    NestedTraceHeader header;
+    NestedTraceFrame frame;
+    NestedTraceRect *rects = NULL, extents;
+    uint32_t maxRects = 0, i;
+    uint32_t redMask, greenMask, blueMask;
+    char *backendName = NULL, *display = NULL;
+    double speed = 1, seconds;
+    Bool perRect = FALSE, async = FALSE;
+    int threads = 1, opt, stride, bytesPerPixel, y;
+    uint64_t frames = 0, start, begin;
+    uint8_t *fb, *row;
+    size_t rowBytes;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "b:d:s:raw:")) != -1) {
+        switch (opt) {
+        case 'b':
+            backendName = optarg;
+            break;
+        case 'd':
+            display = optarg;
+            break;
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 'r':
+            perRect = TRUE;
+            break;
+        case 'a':
+            async = TRUE;
+            break;
+        case 'w':
+            threads = atoi(optarg);
+            if (threads < 1)
+                Usage();
+            break;
+        default:
+            Usage();
+        }
+    }
+
+    if (optind != argc - 1)
+        Usage();
+
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    Read(f, &header, sizeof(header));
+    if (header.magic != NESTED_TRACE_MAGIC ||
+        header.version != NESTED_TRACE_VERSION) {
+        fprintf(stderr, "nested-replay: %s is not a damage trace\n",
+                argv[optind]);
+        return 1;
+    }
+
+    if (!header.bitsPerPixel || header.bitsPerPixel % 8) {
+        fprintf(stderr, "nested-replay: can't replay %u bits per pixel\n",
+                header.bitsPerPixel);
+        return 1;
+    }
+
+    backend = NestedClientFindBackend(backendName);
+    if (!backend) {
+        fprintf(stderr, "nested-replay: no backend \"%s\"\n", backendName);
+        return 1;
+    }
+
+    if (!NestedClientValidDepth(backend, header.depth)) {
+        fprintf(stderr, "nested-replay: the %s backend can't show depth %u\n",
+                backend->name, header.depth);
+        return 1;
+    }
+
+    pPriv = NestedClientCreateScreen(backend, 0, display,
+                                     header.width, header.height,
+                                     header.width, header.height, 0, 0,
+                                     header.depth, header.bitsPerPixel,
+                                     0, 0, &redMask, &greenMask, &blueMask);
+    if (!pPriv) {
+        fprintf(stderr, "nested-replay: can't create a %ux%u screen\n",
+                header.width, header.height);
+        return 1;
+    }
+
+    if ((header.flags & NESTED_TRACE_PIXELS) &&
+        (redMask != header.redMask || greenMask != header.greenMask ||
+         blueMask != header.blueMask))
+        fprintf(stderr, "nested-replay: the framebuffer has other masks "
+                        "than the trace, colors will be off\n");
+
+    /* Watchable with nested-stat like a server */
+    stats = NestedStatsCreate(0, backend->name, display);
+    NestedClientSetStats(pPriv, stats);
+
+    if (async && !NestedClientSetAsync(pPriv))
+        fprintf(stderr, "nested-replay: can't upload asynchronously\n");
+
+    if (threads > 1) {
+        workers = NestedWorkersCreate(threads - 1);
+        NestedClientSetWorkers(pPriv, workers);
+    }
+
+    fb = (uint8_t *)NestedClientGetFrameBuffer(pPriv);
+    stride = ((header.width * header.bitsPerPixel + 31) / 32) * 4;
+    bytesPerPixel = header.bitsPerPixel / 8;
+
+    begin = NestedStatsNow();
+
+    while (fread(&frame, sizeof(frame), 1, f) == 1) {
+        if (frame.numRects > maxRects) {
+            maxRects = frame.numRects;
+            rects = realloc(rects, maxRects * sizeof(NestedTraceRect));
+            if (!rects) {
+                fprintf(stderr, "nested-replay: out of memory\n");
+                return 1;
+            }
+        }
+
+        Read(f, rects, frame.numRects * sizeof(NestedTraceRect));
+        CheckRects(rects, frame.numRects, &header);
+
+        for (i = 0; i < frame.numRects; i++) {
+            rowBytes = (size_t)(rects[i].x2 - rects[i].x1) * bytesPerPixel;
+
+            for (y = rects[i].y1; y < rects[i].y2; y++) {
+                row = fb + (size_t)y * stride + rects[i].x1 * bytesPerPixel;
+
+                if (header.flags & NESTED_TRACE_PIXELS)
+                    Read(f, row, rowBytes);
+                else
+                    memset(row, frames * 37, rowBytes);
+            }
+        }
+
+        if (speed > 0)
+            WaitUntil(begin + frame.time / speed);
+
+        start = NestedStatsNow();
+
+        if (perRect) {
+            for (i = 0; i < frame.numRects; i++)
+                NestedClientUpdateScreen(pPriv, rects[i].x1, rects[i].y1,
+                                         rects[i].x2, rects[i].y2);
+        } else if (frame.numRects) {
+            extents = rects[0];
+            for (i = 1; i < frame.numRects; i++) {
+                extents.x1 = min(extents.x1, rects[i].x1);
+                extents.y1 = min(extents.y1, rects[i].y1);
+                extents.x2 = max(extents.x2, rects[i].x2);
+                extents.y2 = max(extents.y2, rects[i].y2);
+            }
+
+            NestedClientUpdateScreen(pPriv, extents.x1, extents.y1,
+                                     extents.x2, extents.y2);
+        }
+
+        NESTED_STATS_ADD(stats, updates, 1);
+        NESTED_STATS_TIME(stats, updateTime, start);
+        NESTED_STATS_ADD(stats, damageRects, frame.numRects);
+        for (i = 0; i < frame.numRects; i++)
+            NESTED_STATS_ADD(stats, damageArea,
+                             (uint64_t)(rects[i].x2 - rects[i].x1) *
+                             (rects[i].y2 - rects[i].y1));
+
+        NestedClientCheckEvents(pPriv);
+        frames++;
+    }
+
+    seconds = (NestedStatsNow() - begin) / 1e9;
+
+    /* Waits for an uploader thread to finish */
+    NestedClientCloseScreen(pPriv);
+    NestedWorkersDestroy(workers);
+
+    printf("backend %s%s%s, %u threads\n", backend->name,
+           perRect ? ", per rectangle" : "", async ? ", async" : "",
+           threads);
+    printf("%llu frames in %.2f s: %.1f fps\n", (unsigned long long)frames,
+           seconds, seconds > 0 ? frames / seconds : 0);
+
+    if (stats) {
+        printf("%llu uploads, %.1f MB, %.1f us per update\n",
+               (unsigned long long)stats->uploads, stats->uploadBytes / 1e6,
+               stats->updates ?
+                   stats->updateTime / 1000.0 / stats->updates : 0);
+        NestedStatsDestroy(stats);
+    }
+
+    free(rects);
+    fclose(f);
+    return 0;
+}
+
+/* The client code runs inside the X server; these stand in for the
+ * little it uses of it. */
+
+void
+xf86VDrvMsgVerb(int scrnIndex, MessageType type, int verb,
+                const char *format, va_list args) {
+    vfprintf(stderr, format, args);
+}
+
+void
+xf86DrvMsg(int scrnIndex, MessageType type, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    xf86VDrvMsgVerb(scrnIndex, type, 1, format, args);
+    va_end(args);
+}
+
+CARD32
+GetTimeInMillis(void) {
+    return NestedStatsNow() / 1000000;
+}
+
+/* Traces carry no input */
+void
+NestedInputPostMouseMotionEvent(DeviceIntPtr dev, int x, int y,
+                                uint64_t time) {
+}
+
+void
+NestedInputPostButtonEvent(DeviceIntPtr dev, int button, int isDown,
+                           uint64_t time) {
+}
+
+void
+NestedInputPostKeyboardEvent(DeviceIntPtr dev, unsigned int keycode,
+                             int isDown, uint64_t time) {
+}
@@ -0,0 +1,298 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Prints the counters of running nested screens, see nested_stats.h.
+ *
+ * Usage: nested-stat [-l] [-i seconds] [-n count] [page...]
+ *
+ * Without pages, every screen found in NESTED_STATS_DIR is shown. Each
+ * line gives the rates over the last interval, or with -l the input
+ * latency percentiles of that interval, in microseconds. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "nested_stats.h"
+
+#define MAX_PAGES 256
+
+typedef struct {
+    char *path;
+    const NestedStatsPage *page;
+    NestedStatsPage last;
+} Screen;
+
+static Screen screens[MAX_PAGES];
+static int numScreens;
+static int showLatency;
+
+static void
+AddPage(const char *path) {
+    const NestedStatsPage *page;
+    int fd;
+
+    if (numScreens == MAX_PAGES)
+        return;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "nested-stat: %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    page = mmap(NULL, sizeof(NestedStatsPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (page == MAP_FAILED) {
+        fprintf(stderr, "nested-stat: %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) !=
+            NESTED_STATS_MAGIC ||
+        page->version != NESTED_STATS_VERSION) {
+        fprintf(stderr, "nested-stat: %s: not a statistics page\n", path);
+        munmap((void *)page, sizeof(NestedStatsPage));
+        return;
+    }
+
+    /* Left behind by a server that crashed */
+    if (kill(page->pid, 0) < 0 && errno == ESRCH) {
+        munmap((void *)page, sizeof(NestedStatsPage));
+        return;
+    }
+
+    screens[numScreens].path = strdup(path);
+    screens[numScreens].page = page;
+    numScreens++;
+}
+
+static void
+FindPages(void) {
+    char path[512];
+    struct dirent *ent;
+    DIR *dir;
+
+    dir = opendir(NESTED_STATS_DIR);
+    if (!dir)
+        return;
+
+    while ((ent = readdir(dir)))
+        if (!strncmp(ent->d_name, NESTED_STATS_PREFIX,
+                     strlen(NESTED_STATS_PREFIX))) {
+            snprintf(path, sizeof(path), "%s/%s", NESTED_STATS_DIR,
+                     ent->d_name);
+            AddPage(path);
+        }
+
+    closedir(dir);
+}
+
+/* Copies the counters one by one; each is consistent on its own */
+static void
+Sample(const NestedStatsPage *page, NestedStatsPage *out) {
+    const uint64_t *src = &page->updates;
+    uint64_t *dst = &out->updates;
+    size_t i, n = (sizeof(NestedStatsPage) -
+                   offsetof(NestedStatsPage, updates)) / sizeof(uint64_t);
+
+    for (i = 0; i < n; i++)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+static double
+PerCall(uint64_t time, uint64_t calls) {
+    return calls ? time / 1000.0 / calls : 0;
+}
+
+static void
+PrintLatencyHeader(void) {
+    printf("%-8s %-8s %8s %8s %8s %8s %8s %8s %8s %8s %7s\n",
+           "pid.scr", "backend", "ev>post", "p99", "post>dmg", "p99",
+           "dmg>up", "p99", "ev>up", "p99", "samples");
+}
+
+/* Percentiles of the samples taken since the last time */
+static void
+PrintLatency(const NestedStatsHistogram *now, const NestedStatsHistogram *last) {
+    NestedStatsHistogram diff;
+    int i;
+
+    diff.count = now->count - last->count;
+    for (i = 0; i < NESTED_STATS_BUCKETS; i++)
+        diff.buckets[i] = now->buckets[i] - last->buckets[i];
+
+    printf(" %8llu %8llu",
+           (unsigned long long)NestedStatsPercentile(&diff, 0.5),
+           (unsigned long long)NestedStatsPercentile(&diff, 0.99));
+}
+
+static void
+PrintLatencyScreen(Screen *screen) {
+    NestedStatsPage now;
+    NestedStatsPage *last = &screen->last;
+    char id[32];
+
+    Sample(screen->page, &now);
+
+    snprintf(id, sizeof(id), "%d.%d", screen->page->pid,
+             screen->page->scrnIndex);
+    printf("%-8s %-8s", id, screen->page->backend);
+    PrintLatency(&now.eventToPost, &last->eventToPost);
+    PrintLatency(&now.postToDamage, &last->postToDamage);
+    PrintLatency(&now.damageToUpload, &last->damageToUpload);
+    PrintLatency(&now.eventToUpload, &last->eventToUpload);
+    printf(" %7llu\n", (unsigned long long)(now.eventToUpload.count -
+                                            last->eventToUpload.count));
+
+    *last = now;
+}
+
+static void
+PrintHeader(void) {
+    printf("%-8s %-8s %7s %7s %8s %7s %8s %6s %6s %6s %7s %6s %6s %6s "
+           "%7s %7s\n",
+           "pid.scr", "backend", "upd/s", "up/s", "KB/s", "B/up", "rect/s",
+           "Mpx/s", "coal/s", "skip/s", "rtt/s", "ev/s", "post/s",
+           "drop/s", "upd.us", "chk.us");
+}
+
+static void
+PrintScreen(Screen *screen, double seconds) {
+    NestedStatsPage now;
+    NestedStatsPage *last = &screen->last;
+    char id[32];
+
+    Sample(screen->page, &now);
+
+#define RATE(counter) ((now.counter - last->counter) / seconds)
+
+    snprintf(id, sizeof(id), "%d.%d", screen->page->pid,
+             screen->page->scrnIndex);
+    printf("%-8s %-8s %7.1f %7.1f %8.1f %7.0f %8.1f %6.2f %6.1f %6.1f "
+           "%7.1f %6.1f %6.1f %6.1f %7.1f %7.1f\n",
+           id, screen->page->backend,
+           RATE(updates), RATE(uploads), RATE(uploadBytes) / 1024,
+           now.uploads > last->uploads ?
+               (double)(now.uploadBytes - last->uploadBytes) /
+               (now.uploads - last->uploads) : 0,
+           RATE(damageRects), RATE(damageArea) / 1e6,
+           RATE(coalesced), RATE(skipped), RATE(roundTrips),
+           RATE(eventsRead), RATE(eventsPosted), RATE(eventsDropped),
+           PerCall(now.updateTime - last->updateTime,
+                   now.updates - last->updates),
+           PerCall(now.checkTime - last->checkTime,
+                   now.checks - last->checks));
+
+#undef RATE
+
+    *last = now;
+}
+
+static void
+Usage(void) {
+    fprintf(stderr,
+            "usage: nested-stat [-l] [-i seconds] [-n count] [page...]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv) {
+    double interval = 1;
+    struct timespec delay, before, after;
+    long count = -1, n;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "li:n:")) != -1) {
+        switch (opt) {
+        case 'l':
+            showLatency = 1;
+            break;
+        case 'i':
+            interval = atof(optarg);
+            if (interval <= 0)
+                Usage();
+            break;
+        case 'n':
+            count = atol(optarg);
+            break;
+        default:
+            Usage();
+        }
+    }
+
+    if (optind < argc)
+        for (i = optind; i < argc; i++)
+            AddPage(argv[i]);
+    else
+        FindPages();
+
+    if (!numScreens) {
+        fprintf(stderr, "nested-stat: no nested screens found\n");
+        return 1;
+    }
+
+    for (i = 0; i < numScreens; i++)
+        Sample(screens[i].page, &screens[i].last);
+
+    delay.tv_sec = (time_t)interval;
+    delay.tv_nsec = (long)((interval - delay.tv_sec) * 1e9);
+    clock_gettime(CLOCK_MONOTONIC, &before);
+
+    for (n = 0; count < 0 || n < count; n++) {
+        nanosleep(&delay, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+
+        if (n % 20 == 0) {
+            if (showLatency)
+                PrintLatencyHeader();
+            else
+                PrintHeader();
+        }
+
+        for (i = 0; i < numScreens; i++) {
+            if (showLatency)
+                PrintLatencyScreen(&screens[i]);
+            else
+                PrintScreen(&screens[i],
+                            (after.tv_sec - before.tv_sec) +
+                            (after.tv_nsec - before.tv_nsec) / 1e9);
+        }
+
+        fflush(stdout);
+        before = after;
+    }
+
+    return 0;
+}